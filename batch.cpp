@@ -0,0 +1,435 @@
+/**************************************************************************//**
+ * @file   batch.cpp
+ * @brief  This source file implements the headless batch mode.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "ctfile.h"
+#include "ocl/ocl_ttrace.h"
+
+using namespace std;
+using namespace cv;
+
+/* ------------------------------------------------------------------------- *
+ * Define Constants                                                          *
+ * ------------------------------------------------------------------------- */
+
+#define PROGRESS_INTERVAL (100) // images between progress reports
+
+/* ------------------------------------------------------------------------- *
+ * Define Types                                                              *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief A single image as it moves through the pipeline.
+ */
+
+typedef struct BATCH_JOB
+{
+	uint64_t    index; // position in the input stream
+	string      path;  // source image path
+	string      name;  // output file name, unique within the batch
+	uint32_t    rows;  // image height
+	uint32_t    cols;  // image width
+	Mat         img;   // binary image (filled in by a decoder)
+	Mat         ctbl;  // contour table (filled in by the tracer)
+	uint32_t    n_ids; // contour identifiers handed out by the tracer
+	TimeProfile tp;    // trace time profile
+} batch_job_t;
+
+/* ------------------------------------------------------------------------- *
+ * Declare Internal Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+static string unique_name(const string &path, set<string> &names);
+static void read_sources(const batch_config_t &cfg, BoundedQueue<batch_job_t> &q_out);
+static void decode_images(BoundedQueue<batch_job_t> &q_in, BoundedQueue<batch_job_t> &q_out,
+                          atomic<uint32_t> &live, atomic<uint64_t> &n_failed);
+static void write_results(const batch_config_t &cfg, BoundedQueue<batch_job_t> &q_in,
+                          atomic<uint64_t> &n_done, atomic<uint64_t> &n_unwritten);
+static bool write_ctbl(const batch_config_t &cfg, const batch_job_t &job);
+
+/* ------------------------------------------------------------------------- *
+ * Define Internal Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Derive an output name from an image path.
+ *
+ * The name is the path's basename. Images which share a basename (e.g. from
+ * different directories of a file list) get ".1", ".2", ... appended in
+ * input order, so their results don't overwrite each other.
+ *
+ * @param[in]     path  Source image path.
+ * @param[in,out] names Names handed out so far.
+ *
+ * @return The output name, without an extension.
+ */
+
+static string unique_name(const string &path, set<string> &names)
+{
+	size_t slash = path.find_last_of('/');
+	string base  = (slash == string::npos) ? path : path.substr(slash+1);
+	string name  = base;
+
+	for(uint32_t n = 1; !names.insert(name).second; n++)
+	{
+		name = base + "." + to_string(n);
+	}
+
+	return name;
+}
+
+/**
+ * @brief Feed image paths into the pipeline.
+ *
+ * The source is either "-" (one path per line on stdin), a directory (every
+ * regular file in name order), or a text file with one path per line.
+ *
+ * @param cfg   Batch settings.
+ * @param q_out Queue receiving one job per path.
+ */
+
+static void read_sources(const batch_config_t &cfg, BoundedQueue<batch_job_t> &q_out)
+{
+	struct stat st;
+	vector<string> paths;
+	set<string> names;
+	string line;
+	batch_job_t job;
+
+	job.index = 0;
+
+	if(cfg.source == "-")
+	{
+		// stream from stdin so paths are traced while they're still arriving
+		while(getline(cin, line))
+		{
+			if(line.empty())
+				continue;
+
+			job.path = line;
+			job.name = unique_name(line, names);
+			if(!q_out.Push(job))
+				break;
+
+			job.index++;
+		}
+
+		q_out.Close();
+		return;
+	}
+
+	if(stat(cfg.source.c_str(), &st) != 0)
+	{
+		cerr << "Error: Unable to access '" << cfg.source << "'." << endl;
+	}
+
+	else if(S_ISDIR(st.st_mode))
+	{
+		DIR *dir = opendir(cfg.source.c_str());
+		struct dirent *ent;
+
+		while(dir && ((ent = readdir(dir)) != NULL))
+		{
+			string path = cfg.source + "/" + ent->d_name;
+
+			if(ent->d_name[0] == '.')
+				continue;
+
+			if((stat(path.c_str(), &st) == 0) && S_ISREG(st.st_mode))
+				paths.push_back(path);
+		}
+
+		if(dir)
+			closedir(dir);
+
+		sort(paths.begin(), paths.end());
+	}
+
+	else
+	{
+		ifstream list(cfg.source.c_str());
+
+		while(getline(list, line))
+		{
+			if(!line.empty())
+				paths.push_back(line);
+		}
+	}
+
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		job.path = paths[i];
+		job.name = unique_name(paths[i], names);
+		if(!q_out.Push(job))
+			break;
+
+		job.index++;
+	}
+
+	q_out.Close();
+}
+
+/**
+ * @brief Decoder worker: read images and binarize them.
+ *
+ * The last worker to exit closes the output queue.
+ *
+ * @param q_in     Queue of jobs holding only a path.
+ * @param q_out    Queue of jobs holding a decoded binary image.
+ * @param live     Number of decoder workers still running.
+ * @param n_failed Counter of images which couldn't be read.
+ */
+
+static void decode_images(BoundedQueue<batch_job_t> &q_in, BoundedQueue<batch_job_t> &q_out,
+                          atomic<uint32_t> &live, atomic<uint64_t> &n_failed)
+{
+	batch_job_t job;
+
+	while(q_in.Pop(job))
+	{
+		job.img = imread(job.path, IMREAD_GRAYSCALE);
+
+		if(!job.img.data)
+		{
+			cerr << "Error: Unable to read '" << job.path << "'." << endl;
+			n_failed++;
+			continue;
+		}
+
+		bitwise_not(job.img, job.img);
+		job.rows = job.img.rows;
+		job.cols = job.img.cols;
+
+		if(!q_out.Push(job))
+			break;
+	}
+
+	if(--live == 0)
+		q_out.Close();
+}
+
+/**
+ * @brief Writer stage: store each contour table as it's traced.
+ *
+ * @param cfg         Batch settings.
+ * @param q_in        Queue of traced jobs.
+ * @param n_done      Counter of images written.
+ * @param n_unwritten Counter of images whose results couldn't be written.
+ */
+
+static void write_results(const batch_config_t &cfg, BoundedQueue<batch_job_t> &q_in,
+                          atomic<uint64_t> &n_done, atomic<uint64_t> &n_unwritten)
+{
+	batch_job_t job;
+
+	while(q_in.Pop(job))
+	{
+		if(!write_ctbl(cfg, job))
+		{
+			cerr << "Error: Unable to write results for '" << job.path << "'." << endl;
+			n_unwritten++;
+			continue;
+		}
+
+		if((++n_done % PROGRESS_INTERVAL) == 0)
+			cerr << n_done << " images written" << endl;
+	}
+}
+
+/**
+ * @brief Write a contour table.
+ *
+ * Tables go to '<out_dir>/<output name>.ctf' as contour files, or use the
+ * same text layout as the demo when text output is selected.
+ *
+ * @param cfg Batch settings.
+ * @param job A traced job.
+ *
+ * @return True if the table was written. False otherwise.
+ */
+
+static bool write_ctbl(const batch_config_t &cfg, const batch_job_t &job)
+{
+	FILE *fout = stdout;
+
+	if(job.n_ids > (uint32_t)job.ctbl.rows)
+	{
+		cerr << "Warning: " << (job.n_ids - job.ctbl.rows) << " contours of '" << job.path
+		     << "' didn't fit in the contour table." << endl;
+	}
+
+	if(!cfg.out_dir.empty())
+	{
+		string path = cfg.out_dir + "/" + job.name + (cfg.text_out ? ".txt" : ".ctf");
+
+		if(!cfg.text_out)
+			return WriteContourFile(path, job.ctbl, job.rows, job.cols, job.n_ids);
+
+		fout = fopen(path.c_str(), "w");
+		if(!fout)
+			return false;
+	}
+
+	else
+	{
+		fprintf(fout, "# %s\n", job.path.c_str());
+	}
+
+	for(int row = 0; row < job.ctbl.rows; row++)
+	{
+		const uint32_t *p_row = job.ctbl.ptr<uint32_t>(row);
+		uint32_t size = min(p_row[0], (uint32_t)job.ctbl.cols);
+
+		fprintf(fout, "%i : ", row);
+
+		for(uint32_t col = 1; (col+1) < size; col += 2)
+		{
+			fprintf(fout, "(%u,%u) ", p_row[col], p_row[col+1]);
+		}
+
+		fprintf(fout, "\n");
+	}
+
+	if(fout != stdout)
+		fclose(fout);
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- *
+ * Define External Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Trace every image named by a source using one OCL_TTrace.
+ *
+ * Reading paths, decoding, tracing and writing run as separate stages
+ * connected by bounded queues, so they overlap instead of running back to
+ * back. Only the calling thread touches the OpenCL objects.
+ *
+ * @param cfg Batch settings.
+ *
+ * @return Process exit code.
+ */
+
+int RunBatch(const batch_config_t &cfg)
+{
+	BoundedQueue<batch_job_t> q_paths(cfg.queue_depth);
+	BoundedQueue<batch_job_t> q_decoded(cfg.queue_depth);
+	BoundedQueue<batch_job_t> q_traced(cfg.queue_depth);
+
+	atomic<uint32_t> live(cfg.n_decoders);
+	atomic<uint64_t> n_failed(0);
+	atomic<uint64_t> n_done(0);
+	atomic<uint64_t> n_unwritten(0);
+
+	vector<thread> decoders;
+	TimeProfile tp_sum;
+	batch_job_t job;
+
+	// the per-cycle kernel trace table would dominate the run time
+	OCL_TTrace contour("kernel.cl", 100, 100, cfg.ctbl_cols, cfg.ctbl_rows,
+	                   "-D TTRACE_QUIET", cfg.counters);
+
+	// images of many sizes would otherwise leave a buffer per size class behind
+	contour.SetDeviceMemLimit(cfg.mem_limit);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	/* ------ Start Pipeline Stages ------ */
+
+	thread reader(read_sources, cref(cfg), ref(q_paths));
+
+	for(uint32_t i = 0; i < cfg.n_decoders; i++)
+	{
+		decoders.push_back(thread(decode_images, ref(q_paths), ref(q_decoded),
+		                          ref(live), ref(n_failed)));
+	}
+
+	thread writer(write_results, cref(cfg), ref(q_traced), ref(n_done), ref(n_unwritten));
+
+	/* ------ Trace ------ */
+
+	while(q_decoded.Pop(job))
+	{
+		job.ctbl = Mat::zeros(cfg.ctbl_rows, cfg.ctbl_cols, CV_32S);
+
+		if(cfg.pyramid > 1)
+			contour.TracePyramid(job.img, cfg.pyramid, job.ctbl, job.tp);
+		else
+			contour.Trace(job.img, job.ctbl, job.tp);
+		job.n_ids = contour.TraceCount();
+		tp_sum = tp_sum + job.tp;
+
+		job.img.release(); // the writer only needs the contour table
+		q_traced.Push(job);
+	}
+
+	q_traced.Close();
+
+	reader.join();
+	for(size_t i = 0; i < decoders.size(); i++)
+	{
+		decoders[i].join();
+	}
+	writer.join();
+
+	/* ------ Output Results ------ */
+
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cerr << "images traced = " << n_done << " (" << n_failed << " failed, "
+	     << n_unwritten << " not written)" << endl;
+	cerr << "elapsed time  = " << elapsed << " s" << endl;
+	cerr << "throughput    = " << ((elapsed > 0.0) ? n_done / elapsed : 0.0) << " images/s" << endl;
+	cerr << "upload time   = " << tp_sum.ul_time * 1e6 << " us" << endl;
+	cerr << "kernel time   = " << tp_sum.k_time * 1e6 << " us" << endl;
+	cerr << "download time = " << tp_sum.dl_time * 1e6 << " us" << endl;
+	cerr << "device memory = " << contour.DeviceMemUsage() << " bytes (peak "
+	     << contour.DeviceMemPeak() << " bytes)" << endl;
+
+	if(cfg.counters)
+	{
+		for(int i = 0; i < TC_COUNT; i++)
+		{
+			cerr << TimeProfile::CounterName(i) << " = " << tp_sum.counters[i] << endl;
+		}
+	}
+
+	return ((n_failed == 0) && (n_unwritten == 0)) ? 0 : 1;
+}
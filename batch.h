@@ -0,0 +1,142 @@
+/**************************************************************************//**
+ * @file   batch.h
+ * @brief  Header file for the headless batch mode.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+/* ------------------------------------------------------------------------- *
+ * Define External Types                                                     *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Batch mode settings.
+ */
+
+typedef struct BATCH_CONFIG
+{
+	string   source;      // directory, file list, or "-" for stdin
+	string   out_dir;     // output directory ("" writes text to stdout)
+	bool     text_out;    // write text tables instead of contour files
+	bool     counters;    // collect and print the kernel's hot-path counters
+	uint32_t pyramid;     // coarse-to-fine downsampling factor (0 traces whole images)
+	uint32_t n_decoders;  // number of imread worker threads
+	uint32_t queue_depth; // capacity of each stage's queue
+	uint32_t ctbl_rows;   // contour table rows per image
+	uint32_t ctbl_cols;   // contour table columns per image
+	size_t   mem_limit;   // idle device buffers are released above this (bytes)
+} batch_config_t;
+
+/**
+ * @brief A thread-safe FIFO which blocks producers once it's full.
+ *
+ * Pop() keeps returning items after Close() until the queue drains, then
+ * returns false so consumers know to exit.
+ */
+
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : cap(capacity), closed(false) {}
+
+	/**
+	 * @brief Add an item, blocking while the queue is full.
+	 *
+	 * @return False if the queue was closed.
+	 */
+
+	bool Push(const T &item)
+	{
+		unique_lock<mutex> lock(mtx);
+
+		not_full.wait(lock, [this]{ return closed || (items.size() < cap); });
+
+		if(closed)
+			return false;
+
+		items.push_back(item);
+		not_empty.notify_one();
+
+		return true;
+	}
+
+	/**
+	 * @brief Remove the oldest item, blocking while the queue is empty.
+	 *
+	 * @return False if the queue was closed and is empty.
+	 */
+
+	bool Pop(T &item)
+	{
+		unique_lock<mutex> lock(mtx);
+
+		not_empty.wait(lock, [this]{ return closed || !items.empty(); });
+
+		if(items.empty())
+			return false;
+
+		item = items.front();
+		items.pop_front();
+		not_full.notify_one();
+
+		return true;
+	}
+
+	/**
+	 * @brief Stop accepting items and wake every waiting thread.
+	 */
+
+	void Close()
+	{
+		lock_guard<mutex> lock(mtx);
+
+		closed = true;
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+private:
+	deque<T>           items;
+	size_t             cap;
+	bool               closed;
+	mutex              mtx;
+	condition_variable not_full;
+	condition_variable not_empty;
+};
+
+/* ------------------------------------------------------------------------- *
+ * Declare External Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+int RunBatch(const batch_config_t &cfg);
+
+#endif
@@ -0,0 +1,359 @@
+/**************************************************************************//**
+ * @file   ctfile.cpp
+ * @brief  This source file implements the binary contour file format.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ctfile.h"
+
+using namespace std;
+using namespace cv;
+
+/* ------------------------------------------------------------------------- *
+ * Define Constants                                                          *
+ * ------------------------------------------------------------------------- */
+
+#define CTF_WRITE_BUFFER (1 << 20) // stdio buffer size for the writer
+
+/* ------------------------------------------------------------------------- *
+ * Define Methods                                                            *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief consturctor
+ */
+
+CTFileReader::CTFileReader()
+{
+	p_base   = NULL;
+	size     = 0;
+	p_header = NULL;
+	p_index  = NULL;
+}
+
+/**
+ * @brief destructor
+ */
+
+CTFileReader::~CTFileReader()
+{
+	Close();
+}
+
+/**
+ * @brief Map a contour file into memory.
+ *
+ * The header and index are validated once here so that Index() and Points()
+ * can hand out pointers into the mapping without further checks.
+ *
+ * @param path Path to the contour file.
+ *
+ * @return True if the file was mapped and is well formed. False otherwise.
+ */
+
+bool CTFileReader::Open(const string &path)
+{
+	struct stat st;
+	int fd;
+	void *p_map;
+
+	Close();
+
+	fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	if((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(ctf_header_t)))
+	{
+		close(fd);
+		return false;
+	}
+
+	p_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // the mapping stays valid after the descriptor is closed
+
+	if(p_map == MAP_FAILED)
+		return false;
+
+	p_base   = (const uint8_t*)p_map;
+	size     = st.st_size;
+	p_header = (const ctf_header_t*)p_base;
+
+	if( (p_header->magic != CTF_MAGIC) ||
+	    (p_header->version != CTF_VERSION) ||
+	    (p_header->header_size != sizeof(ctf_header_t)) ||
+	    (p_header->index_offset > size) ||
+	    ((size - p_header->index_offset) / sizeof(ctf_index_t) < p_header->n_contours) )
+	{
+		Close();
+		return false;
+	}
+
+	p_index = (const ctf_index_t*)(p_base + p_header->index_offset);
+
+	// make sure every contour's points lie within the file
+	for(uint32_t i = 0; i < p_header->n_contours; i++)
+	{
+		if( (p_index[i].offset > size) ||
+		    ((size - p_index[i].offset) / sizeof(ctf_point_t) < p_index[i].n_points) )
+		{
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Unmap the contour file.
+ */
+
+void CTFileReader::Close()
+{
+	if(p_base)
+		munmap((void*)p_base, size);
+
+	p_base   = NULL;
+	size     = 0;
+	p_header = NULL;
+	p_index  = NULL;
+}
+
+/**
+ * @brief Get the points of a contour.
+ *
+ * @param i Index entry number.
+ *
+ * @return Pointer to Index(i).n_points points inside the mapping.
+ */
+
+const ctf_point_t *CTFileReader::Points(uint32_t i) const
+{
+	return (const ctf_point_t*)(p_base + p_index[i].offset);
+}
+
+/**
+ * @brief consturctor
+ */
+
+CTFileWriter::CTFileWriter()
+{
+	fout   = NULL;
+	offset = 0;
+	ok     = false;
+}
+
+/**
+ * @brief destructor
+ */
+
+CTFileWriter::~CTFileWriter()
+{
+	if(fout)
+		Close();
+}
+
+/**
+ * @brief Create a contour file.
+ *
+ * A placeholder header is written right away. Close() fills it in once the
+ * index has been written.
+ *
+ * @param path     Output path.
+ * @param img_rows Traced image height.
+ * @param img_cols Traced image width.
+ *
+ * @return True if the file was created. False otherwise.
+ */
+
+bool CTFileWriter::Open(const string &path, uint32_t img_rows, uint32_t img_cols)
+{
+	if(fout)
+		Close();
+
+	index.clear();
+	memset(&header, 0, sizeof(header));
+
+	header.magic       = CTF_MAGIC;
+	header.version     = CTF_VERSION;
+	header.header_size = sizeof(ctf_header_t);
+	header.img_rows    = img_rows;
+	header.img_cols    = img_cols;
+
+	fout = fopen(path.c_str(), "wb");
+	if(!fout)
+		return false;
+
+	setvbuf(fout, NULL, _IOFBF, CTF_WRITE_BUFFER);
+
+	ok     = fwrite(&header, sizeof(header), 1, fout) == 1;
+	offset = sizeof(header);
+
+	return ok;
+}
+
+/**
+ * @brief Append a contour.
+ *
+ * @param id       Contour identifier.
+ * @param p_pairs  Packed (row,col) pairs.
+ * @param n_points Number of pairs.
+ * @param flags    CTF_* flags.
+ *
+ * @return False if this or an earlier write failed.
+ */
+
+bool CTFileWriter::Append(uint32_t id, const uint32_t *p_pairs, uint32_t n_points, uint32_t flags)
+{
+	ctf_index_t entry;
+
+	if(!fout || !ok)
+		return false;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.offset   = offset;
+	entry.id       = id;
+	entry.n_points = n_points;
+	entry.flags    = flags;
+
+	ok = fwrite(p_pairs, sizeof(ctf_point_t), n_points, fout) == n_points;
+
+	index.push_back(entry);
+	offset          += sizeof(ctf_point_t)*n_points;
+	header.n_points += n_points;
+
+	return ok;
+}
+
+/**
+ * @brief Append the contour held in a terminated contour table row.
+ *
+ * Rows which were never terminated (column 0 is still 0) or hold no points
+ * are skipped.
+ *
+ * @param ctbl  Contour table (S32, as filled in by OCL_TTrace).
+ * @param row   Row of the contour table.
+ * @param id    Contour identifier.
+ * @param flags Extra CTF_* flags for the contour.
+ *
+ * @return False if this or an earlier write failed.
+ */
+
+bool CTFileWriter::AppendRow(const Mat &ctbl, int row, uint32_t id, uint32_t flags)
+{
+	const uint32_t *p_row = ctbl.ptr<uint32_t>(row);
+
+	/* NOTE: Column 0 holds the index one past the last written column,
+	 * and stays 0 for rows which were never terminated.
+	 */
+	uint32_t cx = p_row[0];
+
+	if(cx > (uint32_t)ctbl.cols)
+		cx = ctbl.cols;
+
+	if(cx < 3)
+		return ok;
+
+	if((cx + 1) >= (uint32_t)ctbl.cols)
+		flags |= CTF_TRUNCATED;
+
+	return Append(id, p_row + 1, (cx - 1) / 2, flags);
+}
+
+/**
+ * @brief Write the index, fill in the header and close the file.
+ *
+ * @return True if the whole file was written. False otherwise.
+ */
+
+bool CTFileWriter::Close()
+{
+	if(!fout)
+		return false;
+
+	header.n_contours   = index.size();
+	header.index_offset = offset;
+
+	if(ok && !index.empty())
+		ok = fwrite(&index[0], sizeof(ctf_index_t), index.size(), fout) == index.size();
+
+	if(ok)
+		ok = (fseek(fout, 0, SEEK_SET) == 0) &&
+		     (fwrite(&header, sizeof(header), 1, fout) == 1);
+
+	ok &= fclose(fout) == 0;
+	fout = NULL;
+
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- *
+ * Define External Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Write a downloaded contour table as a contour file.
+ *
+ * Every terminated row of the table becomes one contour. The points are
+ * written straight from the table rows since they're already packed
+ * (row,col) pairs.
+ *
+ * @param path     Output path.
+ * @param ctbl     Contour table (S32, as filled in by OCL_TTrace::Trace()).
+ * @param img_rows Traced image height.
+ * @param img_cols Traced image width.
+ * @param n_ids    Contour identifiers handed out by the trace (see
+ *                 OCL_TTrace::TraceCount()). Identifiers past the table's
+ *                 last row are recorded as lost in the header.
+ *
+ * @return True if the file was written. False otherwise.
+ */
+
+bool WriteContourFile(const string &path, const Mat &ctbl,
+                      uint32_t img_rows, uint32_t img_cols, uint32_t n_ids)
+{
+	CTFileWriter writer;
+
+	if(!writer.Open(path, img_rows, img_cols))
+		return false;
+
+	if(n_ids > (uint32_t)ctbl.rows)
+		writer.SetLost(n_ids - ctbl.rows);
+
+	for(int row = 0; row < ctbl.rows; row++)
+	{
+		writer.AppendRow(ctbl, row, row);
+	}
+
+	return writer.Close();
+}
@@ -0,0 +1,167 @@
+/**************************************************************************//**
+ * @file   ctfile.h
+ * @brief  Header file for the binary contour file format.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+using namespace std;
+using namespace cv;
+
+#ifndef CTFILE_H_
+#define CTFILE_H_
+
+/* ------------------------------------------------------------------------- *
+ * Define Constants                                                          *
+ * ------------------------------------------------------------------------- */
+
+/*
+ * File layout (native little-endian, every section 8-byte aligned):
+ *
+ *   ctf_header_t                       at offset 0
+ *   ctf_point_t[...]                   at each index entry's offset
+ *   ctf_index_t[header.n_contours]     at offset header.index_offset
+ *
+ * The point data of a contour is a copy of its contour table row, so a
+ * reader can use the mapped file in place. The index is written last so
+ * contours can be appended as soon as they're finished.
+ */
+
+#define CTF_MAGIC   (0x46435454) // "TTCF"
+#define CTF_VERSION (1)
+
+/*
+ * Define contour flags. These values get assigned to the member 'flags' of
+ * struct 'ctf_index_t'.
+ */
+
+#define CTF_TRUNCATED (1 << 0) // the contour table row ran out of columns
+#define CTF_OVERRUN   (1 << 1) // the contour table row may have been reused
+
+/* ------------------------------------------------------------------------- *
+ * Define External Types                                                     *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Contour file header.
+ */
+
+typedef struct __attribute__((__packed__)) CTF_HEADER
+{
+	uint32_t magic;        // CTF_MAGIC
+	uint16_t version;      // CTF_VERSION
+	uint16_t header_size;  // sizeof(ctf_header_t)
+	uint32_t img_rows;     // traced image height
+	uint32_t img_cols;     // traced image width
+	uint32_t n_contours;   // number of index entries
+	uint32_t n_lost;       // contours missing because the contour table was full
+	uint64_t index_offset; // byte offset of the index
+	uint64_t n_points;     // total number of points in the file
+} ctf_header_t;
+
+/**
+ * @brief Contour file index entry.
+ */
+
+typedef struct __attribute__((__packed__)) CTF_INDEX
+{
+	uint64_t offset;   // byte offset of the contour's points
+	uint32_t id;       // contour identifier
+	uint32_t n_points; // number of points
+	uint32_t flags;    // CTF_* flags
+	uint32_t reserved; // zero
+} ctf_index_t;
+
+/**
+ * @brief A contour point.
+ */
+
+typedef struct __attribute__((__packed__)) CTF_POINT
+{
+	uint32_t row;
+	uint32_t col;
+} ctf_point_t;
+
+/**
+ * @brief Read-only view of a contour file mapped into memory.
+ */
+
+class CTFileReader
+{
+public:
+	CTFileReader();
+	~CTFileReader();
+
+	bool Open(const string &path);
+	void Close();
+
+	const ctf_header_t &Header() const { return *p_header; }
+	uint32_t Count() const { return p_header ? p_header->n_contours : 0; }
+	const ctf_index_t &Index(uint32_t i) const { return p_index[i]; }
+	const ctf_point_t *Points(uint32_t i) const;
+
+private:
+	const uint8_t      *p_base;   // start of the mapping
+	size_t              size;     // size of the mapping in bytes
+	const ctf_header_t *p_header; // file header
+	const ctf_index_t  *p_index;  // first index entry
+};
+
+/**
+ * @brief Writes a contour file one contour at a time.
+ */
+
+class CTFileWriter
+{
+public:
+	CTFileWriter();
+	~CTFileWriter();
+
+	bool Open(const string &path, uint32_t img_rows, uint32_t img_cols);
+	bool Append(uint32_t id, const uint32_t *p_pairs, uint32_t n_points, uint32_t flags);
+	bool AppendRow(const Mat &ctbl, int row, uint32_t id, uint32_t flags = 0);
+	void SetLost(uint32_t n_lost) { header.n_lost = n_lost; }
+	bool Close();
+
+	uint32_t Count() const { return index.size(); }
+
+private:
+	FILE               *fout;   // output file
+	ctf_header_t        header; // header, rewritten by Close()
+	vector<ctf_index_t> index;  // index of the appended contours
+	uint64_t            offset; // current end of the point data
+	bool                ok;     // false once a write failed
+};
+
+/* ------------------------------------------------------------------------- *
+ * Declare External Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+bool WriteContourFile(const string &path, const Mat &ctbl,
+                      uint32_t img_rows, uint32_t img_cols, uint32_t n_ids = 0);
+
+#endif
@@ -30,7 +30,17 @@
  * Define Constants                                                          *
  * ------------------------------------------------------------------------- */
 
-#define LOCAL_SIZE_MAX (128)
+#define LOCAL_SIZE_MAX (128) // largest work-group size the host launches
+
+// Define TTRACE_QUIET (e.g. with the build option "-D TTRACE_QUIET") to
+// suppress the per-cycle execution table.
+
+// Define TTRACE_COUNTERS to collect the hot-path counters. Their indices
+// (TC_ACTIVE ... TC_COUNT) are passed as build options by OCL_TTrace, from
+// TTRACE_COUNTER_LIST in ocl_ttrace.h.
+#ifndef TC_COUNT
+#error "the TC_* counter indices must be passed as build options"
+#endif
 
 // For terminal colors.
 #define KNRM  "\x1B[0m"
@@ -46,6 +56,12 @@
  * Define Macros                                                             *
  * ------------------------------------------------------------------------- */
 
+#ifdef TTRACE_COUNTERS
+#define STAT_INC(p_stats, i) ((p_stats)->n[i]++)
+#else
+#define STAT_INC(p_stats, i)
+#endif
+
 /* ------------------------------------------------------------------------- *
  * Define Types                                                              *
  * ------------------------------------------------------------------------- */
@@ -104,6 +120,15 @@ typedef struct PE_INFO
 	token_t *held_token; // entry of the held token
 } pe_info_t;
 
+/**
+ * @brief Hot-path counters of a single PE.
+ */
+
+typedef struct PE_STATS
+{
+	uint n[TC_COUNT];
+} pe_stats_t;
+
 /**
  * @brief Define the contour table.
  */
@@ -114,6 +139,15 @@ typedef struct CONTOUR_TABLE
 	__global uint *cnt;  // row counter
 	uint rows; // number of rows in the table
 	uint cols; // number of columns in the table
+	bool wrap; // identifiers wrap around the rows (streaming only)
+	
+	__global uint *labels; // label image (optional)
+	__global uchar *img;   // traced image, to skip background contour points
+	__global uint *parent; // label union-find table (optional)
+	uint img_rows;         // label image rows
+	uint img_cols;         // label image columns
+	
+	pe_stats_t *stats;     // counters of the PE using the table
 } ctbl_t;
 
 /* ------------------------------------------------------------------------- *
@@ -145,9 +179,16 @@ void token_clear_global(__global token_t *trg);
 bool token_check(token_t *trg);
 bool token_check_global(__global token_t *trg);
 
+uint ctbl_base(ctbl_t *p_tbl, uint id);
+bool ctbl_has(ctbl_t *p_tbl, uint id);
+void ctbl_begin(ctbl_t *p_tbl, uint id);
+void ctbl_label(ctbl_t *p_tbl, uint id, uint row, uint col);
 void ctbl_append(ctbl_t *p_tbl, token_t *p_tkn, uint row, uint col);
 void ctbl_append_global(ctbl_t *p_tbl, __global token_t *p_tkn, uint row, uint col);
 void cbtl_term(ctbl_t *p_tbl, token_t *p_tkn);
+
+uint label_find(__global uint *parent, uint x);
+void label_unite(__global uint *parent, uint a, uint b);
 void cbtl_term_global(ctbl_t *p_tbl, __global token_t *p_tkn);
 
 void print_title(void);
@@ -338,6 +379,151 @@ bool token_check_global(__global token_t *trg)
 	return(trg->state != 0);
 }
 
+/**
+ * @brief Get the index of the first column of a contour's row.
+ * 
+ * When streaming, contour identifiers wrap around the table, so a table
+ * which is emptied between bands can hold more contours than rows.
+ * 
+ * @param p_tbl Pointer to the contour table.
+ * @param id    Contour identifier.
+ * 
+ * @return Index into the contour table data.
+ */
+
+uint ctbl_base(ctbl_t *p_tbl, uint id)
+{
+	return (p_tbl->wrap ? (id % p_tbl->rows) : id)*p_tbl->cols;
+}
+
+/**
+ * @brief Check if a contour has a row in the table.
+ * 
+ * Without wrapping, contours started after the table filled up are dropped.
+ * The host detects this from the final counter value.
+ * 
+ * @param p_tbl Pointer to the contour table.
+ * @param id    Contour identifier.
+ * 
+ * @return True if the contour's points are recorded.
+ */
+
+bool ctbl_has(ctbl_t *p_tbl, uint id)
+{
+	return p_tbl->wrap || (id < p_tbl->rows);
+}
+
+/**
+ * @brief Claim a contour's row for a newly started contour.
+ * 
+ * A wrapped row may still hold an older contour which terminated, so its
+ * first column is cleared. The host then only sees a non-zero first column
+ * once the new contour terminates.
+ * 
+ * @param p_tbl Pointer to the contour table.
+ * @param id    Contour identifier.
+ */
+
+void ctbl_begin(ctbl_t *p_tbl, uint id)
+{
+	if(p_tbl->wrap)
+	{
+		p_tbl->data[ctbl_base(p_tbl, id)] = 0;
+	}
+}
+
+/**
+ * @brief Label a contour point in the label image.
+ * 
+ * A contour's label is its identifier plus one (0 is background). When two
+ * contours pass through the same foreground pixel, they bound the same
+ * component, so their labels are merged. Contour points on background
+ * pixels can be shared by the contours of different components, so they
+ * aren't labelled.
+ * 
+ * @param p_tbl Pointer to the contour table.
+ * @param id    Contour identifier.
+ * @param row   The row coordinate of the contour point.
+ * @param col   The col coordinate of the contour point.
+ */
+
+void ctbl_label(ctbl_t *p_tbl, uint id, uint row, uint col)
+{
+	uint label = id + 1;
+	uint prev;
+	
+	// labels are only kept for contours which fit in the table
+	if( (!p_tbl->labels) || !ctbl_has(p_tbl, id) ||
+	    (row >= p_tbl->img_rows) || (col >= p_tbl->img_cols) ||
+	    !p_tbl->img[row*p_tbl->img_cols + col] )
+	{
+		return;
+	}
+	
+	prev = atomic_xchg(p_tbl->labels + row*p_tbl->img_cols + col, label);
+	
+	if(prev && (prev != label))
+	{
+		label_unite(p_tbl->parent, prev, label);
+	}
+}
+
+/**
+ * @brief Find the representative of a label.
+ * 
+ * @param parent Label union-find table.
+ * @param x      Target label.
+ * 
+ * @return The smallest label in the same set once all merges are done.
+ */
+
+uint label_find(__global uint *parent, uint x)
+{
+	while(parent[x] != x)
+	{
+		x = parent[x];
+	}
+	
+	return x;
+}
+
+/**
+ * @brief Merge the sets of two labels.
+ * 
+ * Roots are always linked to a smaller root with a compare-and-swap, so
+ * concurrent merges from different PEs can't form a cycle.
+ * 
+ * @param parent Label union-find table.
+ * @param a      First label.
+ * @param b      Second label.
+ */
+
+void label_unite(__global uint *parent, uint a, uint b)
+{
+	while(true)
+	{
+		a = label_find(parent, a);
+		b = label_find(parent, b);
+		
+		if(a == b)
+		{
+			return;
+		}
+		
+		if(a < b)
+		{
+			uint tmp = a;
+			a = b;
+			b = tmp;
+		}
+		
+		if(atomic_cmpxchg(parent + a, a, b) == a)
+		{
+			return;
+		}
+	}
+}
+
 /**
  * @brief Append a contour point.
  * 
@@ -349,7 +535,17 @@ bool token_check_global(__global token_t *trg)
 
 void ctbl_append(ctbl_t *p_tbl, token_t *p_tkn, uint row, uint col)
 {
-	uint base = p_tkn->id*p_tbl->cols;
+	uint base = ctbl_base(p_tbl, p_tkn->id);
+	
+	// the contour's identifier is past the table's last row
+	if(!ctbl_has(p_tbl, p_tkn->id))
+	{
+		STAT_INC(p_tbl->stats, TC_DROP);
+		return;
+	}
+	
+	ctbl_label(p_tbl, p_tkn->id, row, col);
+	STAT_INC(p_tbl->stats, TC_APPEND);
 	
 	// check if there's room to add a new point
 	if((p_tkn->cx+1) < p_tbl->cols)
@@ -357,11 +553,26 @@ void ctbl_append(ctbl_t *p_tbl, token_t *p_tkn, uint row, uint col)
 		p_tbl->data[base+p_tkn->cx++] = row;
 		p_tbl->data[base+p_tkn->cx++] = col;
 	}
+	
+	else
+	{
+		STAT_INC(p_tbl->stats, TC_DROP);
+	}
 }
 
 void ctbl_append_global(ctbl_t *p_tbl, __global token_t *p_tkn, uint row, uint col)
 {
-	uint base = p_tkn->id*p_tbl->cols;
+	uint base = ctbl_base(p_tbl, p_tkn->id);
+	
+	// the contour's identifier is past the table's last row
+	if(!ctbl_has(p_tbl, p_tkn->id))
+	{
+		STAT_INC(p_tbl->stats, TC_DROP);
+		return;
+	}
+	
+	ctbl_label(p_tbl, p_tkn->id, row, col);
+	STAT_INC(p_tbl->stats, TC_APPEND);
 	
 	// check if there's room to add a new point
 	if((p_tkn->cx+1) < p_tbl->cols)
@@ -369,6 +580,11 @@ void ctbl_append_global(ctbl_t *p_tbl, __global token_t *p_tkn, uint row, uint c
 		p_tbl->data[base+p_tkn->cx++] = row;
 		p_tbl->data[base+p_tkn->cx++] = col;
 	}
+	
+	else
+	{
+		STAT_INC(p_tbl->stats, TC_DROP);
+	}
 }
 
 /**
@@ -380,7 +596,12 @@ void ctbl_append_global(ctbl_t *p_tbl, __global token_t *p_tkn, uint row, uint c
 
 void cbtl_term(ctbl_t *p_tbl, token_t *p_tkn)
 {
-	uint base = p_tkn->id*p_tbl->cols;
+	uint base = ctbl_base(p_tbl, p_tkn->id);
+	
+	if(!ctbl_has(p_tbl, p_tkn->id))
+	{
+		return;
+	}
 	
 	// Record the number of contour coordinates in the first column.
 	p_tbl->data[base] = p_tkn->cx; 
@@ -388,7 +609,12 @@ void cbtl_term(ctbl_t *p_tbl, token_t *p_tkn)
 
 void cbtl_term_global(ctbl_t *p_tbl, __global token_t *p_tkn)
 {
-	uint base = p_tkn->id*p_tbl->cols;
+	uint base = ctbl_base(p_tbl, p_tkn->id);
+	
+	if(!ctbl_has(p_tbl, p_tkn->id))
+	{
+		return;
+	}
 	
 	// Record the number of contour coordinates in the first column.
 	p_tbl->data[base] = p_tkn->cx; 
@@ -479,6 +705,8 @@ void pe_case1(pe_info_t *p_info, uint row, uint col, ctbl_t *p_tbl)
 			p_info->pass_token->ocol  = col;
 			
 			p_info->pass_token->id = atomic_inc(p_tbl->cnt);
+			STAT_INC(p_tbl->stats, TC_IDS);
+			ctbl_begin(p_tbl, p_info->pass_token->id);
 			
 			/* NOTE: Index 0 (the first column in the contour table) 
 			 * shall store the number of appended coordinates within 
@@ -497,6 +725,8 @@ void pe_case1(pe_info_t *p_info, uint row, uint col, ctbl_t *p_tbl)
 		p_info->held_token->ocol  = col;
 		
 		p_info->held_token->id = atomic_inc(p_tbl->cnt);
+		STAT_INC(p_tbl->stats, TC_IDS);
+		ctbl_begin(p_tbl, p_info->held_token->id);
 		
 		/* NOTE: Index 0 (the first column in the contour table) 
 		 * shall store the number of appended coordinates within 
@@ -527,6 +757,8 @@ void pe_case1(pe_info_t *p_info, uint row, uint col, ctbl_t *p_tbl)
 			p_info->pass_token->ocol  = col;
 			
 			p_info->pass_token->id = atomic_inc(p_tbl->cnt);
+			STAT_INC(p_tbl->stats, TC_IDS);
+			ctbl_begin(p_tbl, p_info->pass_token->id);
 			
 			/* NOTE: Index 0 (the first column in the contour table) 
 			 * shall store the number of appended coordinates within 
@@ -545,6 +777,8 @@ void pe_case1(pe_info_t *p_info, uint row, uint col, ctbl_t *p_tbl)
 		p_info->held_token->ocol  = col;
 		
 		p_info->held_token->id = atomic_inc(p_tbl->cnt);
+		STAT_INC(p_tbl->stats, TC_IDS);
+		ctbl_begin(p_tbl, p_info->held_token->id);
 		
 		/* NOTE: Index 0 (the first column in the contour table) 
 		 * shall store the number of appended coordinates within 
@@ -814,6 +1048,38 @@ void pe_gencon_global(pe_info_t *p_info, __global token_t *p_tkn, ctbl_t *p_tbl,
  * Define Kernels                                                            *
  * ------------------------------------------------------------------------- */
 
+/**
+ * @brief Trace the contours of a binary image (or one band of it).
+ * 
+ * When tracing an image in horizontal bands, 'row_base' is the image row of
+ * the band's first row and 'bin_img' starts with one halo row (the last row
+ * of the previous band). Tokens passed into the band's first row are read
+ * from 'carry_in' (one entry per column) and tokens passed out of the band's
+ * last row are written to 'carry_out'. For a whole image, 'row_base' is 0 and
+ * both carry pointers are NULL.
+ * 
+ * Contour identifiers only wrap around the contour table while streaming
+ * (see ctbl_base()). For a whole image, contours whose identifier is past
+ * the table's last row are dropped, and the host can tell how many from the
+ * final value of 'ctbl_cnt'.
+ * 
+ * If 'label_img' isn't NULL, every contour point is labelled in it (see
+ * ctbl_label()) and LABEL_FILL, LABEL_LINK and LABEL_RESOLVE can then turn it into a
+ * connected-component label image. Labels aren't supported for bands.
+ * 
+ * When built with TTRACE_COUNTERS, each PE counts its hot-path events
+ * privately. The counts are summed per work-group in local memory and then
+ * added to 'counters' (TC_COUNT entries) with one atomic per counter.
+ * 
+ * A pixel is foreground if it's greater than the level's threshold. When
+ * 'thresholds' is NULL, a single level with threshold 0 is traced, so any
+ * non-zero pixel is foreground. Otherwise the global range is split evenly
+ * into 'n_levels' PE sets, one per threshold, each with its own slice of
+ * the token table, its own contour table (ctbl_rows x ctbl_cols entries,
+ * one after the other) and its own counter in 'ctbl_cnt'. Each set must be
+ * a multiple of the local size so no work-group spans two levels.
+ */
+
 __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 				    __global token_t *token_table,
 				    const uint rows,
@@ -821,13 +1087,38 @@ __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 				    __global uint *ctbl_cnt,
 				    __global uint *ctbl_data,
 				    const uint ctbl_rows,
-				    const uint ctbl_cols)
+				    const uint ctbl_cols,
+				    const uint row_base,
+				    __global token_t *carry_in,
+				    __global token_t *carry_out,
+				    __global uint *label_img,
+				    __global uint *label_parent,
+				    __global ulong *counters,
+				    __global const uchar *thresholds,
+				    const uint n_levels)
 {
 	
 	unsigned int local_id = get_local_id(0);
-	unsigned int row = get_global_id(0);
+	unsigned int level_size = get_global_size(0) / n_levels;
+	unsigned int level = get_global_id(0) / level_size;
+	unsigned int row = get_global_id(0) % level_size;
 	unsigned int col = 0;
 	
+	const uchar thresh = thresholds ? thresholds[level] : 0;
+	
+	// select this level's token table slice, counter and contour table
+	token_table += level*level_size;
+	ctbl_cnt    += level;
+	ctbl_data   += level*ctbl_rows*ctbl_cols;
+	
+	// skip the halo row, which is only read as the previous row
+	const bool has_halo = (row_base != 0);
+	
+	if(has_halo)
+	{
+		bin_img += cols;
+	}
+	
 	__global unsigned char *bin_img_prev_row = bin_img + cols*(row-1);
 	__global unsigned char *bin_img_row = bin_img + cols*row;
 	
@@ -855,9 +1146,19 @@ __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 		.data = ctbl_data,
 		.cnt  = ctbl_cnt,
 		.rows = ctbl_rows,
-		.cols = ctbl_cols
+		.cols = ctbl_cols,
+		.wrap = (carry_out != 0),
+		.labels   = label_img,
+		.img      = bin_img,
+		.parent   = label_parent,
+		.img_rows = rows,
+		.img_cols = cols
 	};
 	
+	pe_stats_t stats = { .n = { 0 } };
+	
+	ctbl.stats = &stats;
+	
 	// ------------------------------------------------------------
 	// Initialize PE state.
 	
@@ -871,12 +1172,14 @@ __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 	
 	// ------------------------------------------------------------
 	
+	#ifndef TTRACE_QUIET
 	if(row == 0)
 	{ 
 		printf("Contour Table: rows=%i cols=%i init(cnt)=%i\r\n", ctbl.rows, ctbl.cols, *ctbl.cnt);
 		printf("Total Cycles = %i\r\n", T);	
 		print_title();
 	}
+	#endif
 	
 	barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 	
@@ -886,6 +1189,7 @@ __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 		
 		if( (row >= rows) || (col >= cols) )
 		{
+			STAT_INC(&stats, TC_IDLE);
 			barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 			barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 			continue;
@@ -895,6 +1199,7 @@ __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 		
 		if(t < 2*row)
 		{
+			STAT_INC(&stats, TC_STALLED);
 			barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 			barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 			continue;
@@ -902,31 +1207,224 @@ __kernel void TOKEN_TRACE ( __global uchar *bin_img,
 		
 		/* ------ execute next cycle for PE(i) ----- */
 		
+		STAT_INC(&stats, TC_ACTIVE);
+		
+		// the first row of a band receives tokens from the previous band
+		if(carry_in && (row == 0))
+		{
+			token_table[0] = carry_in[col];
+		}
+		
 		pe_begin(&info, 
-			   (col < (cols-1)) ? bin_img_row[col+1] : 0, 
-			   (row != 0) ? bin_img_prev_row[col] : 0);
+			   (col < (cols-1)) ? (bin_img_row[col+1] > thresh) : 0, 
+			   ((row != 0) || has_halo) ? (bin_img_prev_row[col] > thresh) : 0);
 		
 		barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 		
 		switch(info.ecase)
 		{
 			case 1:
-				pe_case1(&info, row, col, &ctbl);
+				pe_case1(&info, row_base+row, col, &ctbl);
 				break;
 				
 			case 2:
-				pe_case2(&info, row, col, &ctbl);
+				pe_case2(&info, row_base+row, col, &ctbl);
 				break;
 				
 			case 3:
-				pe_case3(&info, row, col, &ctbl);
+				pe_case3(&info, row_base+row, col, &ctbl);
 				break;
 		}
 		
+		#ifdef TTRACE_COUNTERS
+		stats.n[TC_CASE1] += (info.ecase == 1);
+		stats.n[TC_CASE2] += (info.ecase == 2);
+		stats.n[TC_CASE3] += (info.ecase == 3);
+		stats.n[TC_TPASS] += info.was_tpass;
+		stats.n[TC_START] += (info.is_osp || info.is_isp);
+		stats.n[TC_END]   += info.is_ep;
+		#endif
+		
+		// the last row of a band passes tokens on to the next band
+		if(carry_out && (row == (rows-1)))
+		{
+			carry_out[col] = token_table[rows];
+			token_table[rows].state = 0;
+		}
+		
+		#ifndef TTRACE_QUIET
 		print_info(&info, row, col, t);
+		#endif
 		
 		barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
 		
 		col++;
 	}
+	
+	// ------------------------------------------------------------
+	// Reduce the hot-path counters.
+	
+	#ifdef TTRACE_COUNTERS
+	__local uint wg_stats[TC_COUNT];
+	
+	for(t = local_id; t < TC_COUNT; t += get_local_size(0))
+	{
+		wg_stats[t] = 0;
+	}
+	
+	barrier(CLK_LOCAL_MEM_FENCE);
+	
+	for(t = 0; t < TC_COUNT; t++)
+	{
+		if(stats.n[t])
+		{
+			atomic_add(wg_stats+t, stats.n[t]);
+		}
+	}
+	
+	barrier(CLK_LOCAL_MEM_FENCE);
+	
+	for(t = local_id; counters && (t < TC_COUNT); t += get_local_size(0))
+	{
+		atom_add(counters+t, (ulong)wg_stats[t]);
+	}
+	#endif
+}
+
+/**
+ * @brief Fill each foreground run with a label and merge the labels it holds.
+ * 
+ * Runs once per row after TOKEN_TRACE. A run which spans an outer and an
+ * inner contour links the two. A run which holds no contour point (e.g. of
+ * a contour that didn't fit in the table) gets a label of its own, from
+ * 'label_base' on, so every foreground pixel is labelled afterwards.
+ */
+
+__kernel void LABEL_FILL ( __global uchar *bin_img,
+				   const uint rows,
+				   const uint cols,
+				   __global uint *label_img,
+				   __global uint *label_parent,
+				   const uint label_base)
+{
+	unsigned int row = get_global_id(0);
+	unsigned int col = 0;
+	
+	if(row >= rows)
+	{
+		return;
+	}
+	
+	__global unsigned char *bin_img_row = bin_img + cols*row;
+	__global unsigned int *label_row = label_img + cols*row;
+	
+	while(col < cols)
+	{
+		unsigned int start = col;
+		unsigned int label = 0;
+		
+		if(!bin_img_row[col])
+		{
+			label_row[col++] = 0;
+			continue;
+		}
+		
+		for(; (col < cols) && bin_img_row[col]; col++)
+		{
+			unsigned int l = label_row[col];
+			
+			if(!l)
+				continue;
+			
+			if(label)
+				label_unite(label_parent, label, l);
+			else
+				label = l;
+		}
+		
+		if(!label)
+		{
+			label = label_base + row*cols + start;
+			label_parent[label] = label;
+		}
+		
+		for(; start < col; start++)
+		{
+			label_row[start] = label;
+		}
+	}
+}
+
+/**
+ * @brief Merge the labels of 8-adjacent foreground pixels in neighbouring rows.
+ * 
+ * Runs once per row after LABEL_FILL, when every foreground pixel holds a
+ * label. Contour points only link rows where the trace passes through
+ * both, so this makes the result independent of how the contours were
+ * traced (missed diagonal links, several start points of one component).
+ */
+
+__kernel void LABEL_LINK ( __global uchar *bin_img,
+				   const uint rows,
+				   const uint cols,
+				   __global uint *label_img,
+				   __global uint *label_parent)
+{
+	unsigned int row = get_global_id(0);
+	unsigned int col, c;
+	
+	if((row == 0) || (row >= rows))
+	{
+		return;
+	}
+	
+	__global unsigned char *bin_img_prev_row = bin_img + cols*(row-1);
+	__global unsigned char *bin_img_row = bin_img + cols*row;
+	__global unsigned int *label_prev_row = label_img + cols*(row-1);
+	__global unsigned int *label_row = label_img + cols*row;
+	
+	for(col = 0; col < cols; col++)
+	{
+		if(!bin_img_row[col])
+		{
+			continue;
+		}
+		
+		// the pixels above-left, above and above-right
+		for(c = (col > 0) ? col-1 : 0; (c <= col+1) && (c < cols); c++)
+		{
+			if(bin_img_prev_row[c] && (label_prev_row[c] != label_row[col]))
+			{
+				label_unite(label_parent, label_row[col], label_prev_row[c]);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Replace every label with the representative of its set.
+ */
+
+__kernel void LABEL_RESOLVE ( const uint rows,
+				      const uint cols,
+				      __global uint *label_img,
+				      __global uint *label_parent)
+{
+	unsigned int row = get_global_id(0);
+	unsigned int col;
+	
+	if(row >= rows)
+	{
+		return;
+	}
+	
+	__global unsigned int *label_row = label_img + cols*row;
+	
+	for(col = 0; col < cols; col++)
+	{
+		if(label_row[col])
+		{
+			label_row[col] = label_find(label_parent, label_row[col]);
+		}
+	}
 }
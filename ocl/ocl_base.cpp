@@ -43,7 +43,7 @@ using namespace std;
  * ------------------------------------------------------------------------- */
 
 // Uncomment to get debugging output.
-#define OCLBASE_DEBUG
+//#define OCLBASE_DEBUG
 
 /* ------------------------------------------------------------------------- *
  * Declare Internal Functions                                                *
@@ -75,7 +75,7 @@ static char *read_kernel_source(const char *sz_fname)
 	
 	if(!kfile)
 	{
-		printf("ERROR: Failed to load the kernel source file!\r\n");
+		fprintf(stderr, "ERROR: Failed to load the kernel source file!\r\n");
 		exit(1);
 	}
 	
@@ -101,10 +101,11 @@ static char *read_kernel_source(const char *sz_fname)
 /**
  * @brief This constructor shall read and compile a target OCL source file.
  * 
- * @param path Path to the target OCL source file.
+ * @param path    Path to the target OCL source file.
+ * @param options Build options passed to the OCL compiler.
  */
 
-OCL_Base::OCL_Base(string path)
+OCL_Base::OCL_Base(string path, string options)
 {
 	cl_int err;
 	
@@ -119,23 +120,23 @@ OCL_Base::OCL_Base(string path)
 	err = clGetDeviceIDs(cpPlatform, CL_DEVICE_TYPE_CPU, 1, &device_id, NULL);
 	
 	#ifdef OCLBASE_DEBUG
-	printf("creating context...");
+	fprintf(stderr, "creating context...");
 	#endif
 	
 	// Create a context  
 	context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
 	
 	#ifdef OCLBASE_DEBUG
-	printf("done\r\n");
-	printf("creating command queue...");
+	fprintf(stderr, "done\r\n");
+	fprintf(stderr, "creating command queue...");
 	#endif
 	
 	// Create a command queue 
 	queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
 	
 	#ifdef OCLBASE_DEBUG
-	printf("done\r\n");
-	printf("creating OpenCL program from kernel source...");
+	fprintf(stderr, "done\r\n");
+	fprintf(stderr, "creating OpenCL program from kernel source...");
 	#endif
 	
 	// Create the compute program from the source buffer
@@ -143,27 +144,27 @@ OCL_Base::OCL_Base(string path)
 	
 	if(err != CL_SUCCESS)
 	{
-		printf("failed: code = %i\r\n", err);
+		fprintf(stderr, "failed: code = %i\r\n", err);
 		exit(1);
 	}
 	
 	else
 	{
 		#ifdef OCLBASE_DEBUG
-		printf("done\r\n");
+		fprintf(stderr, "done\r\n");
 		#endif
 	}
 	
 	#ifdef OCLBASE_DEBUG
-	printf("building OpenCV program...");
+	fprintf(stderr, "building OpenCV program...");
 	#endif
 	
 	// Build the program executable 
-	err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+	err = clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL);
 	
 	if(err != CL_SUCCESS)
 	{
-		printf("failed: code = %i\r\n", err);
+		fprintf(stderr, "failed: code = %i\r\n", err);
 		
 		size_t len;
 		char *logstr;
@@ -172,10 +173,10 @@ OCL_Base::OCL_Base(string path)
 		logstr = new char[len];
 		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, len, logstr, NULL);
 		
-		printf("--------------------------------------------------\r\n"); 
-		printf("[OpenCL Build Log]\r\n");
-		printf("%s", logstr);
-		printf("\r\n--------------------------------------------------\r\n");
+		fprintf(stderr, "--------------------------------------------------\r\n"); 
+		fprintf(stderr, "[OpenCL Build Log]\r\n");
+		fprintf(stderr, "%s", logstr);
+		fprintf(stderr, "\r\n--------------------------------------------------\r\n");
 		
 		delete [] logstr;
 		exit(1);
@@ -185,7 +186,7 @@ OCL_Base::OCL_Base(string path)
 	else
 	{
 		#ifdef OCLBASE_DEBUG
-		printf("done\r\n");
+		fprintf(stderr, "done\r\n");
 		#endif
 	}
 }
@@ -196,11 +197,19 @@ OCL_Base::OCL_Base(string path)
 
 OCL_Base::~OCL_Base()
 {
-	printf("~OCL_Base(): start\r\n");
+	#ifdef OCLBASE_DEBUG
+	fprintf(stderr, "~OCL_Base(): start\r\n");
+	#endif
 	
 	free(sz_oclsrc);
 	
-	printf("~OCL_Base(): end\r\n");
+	clReleaseProgram(program);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	
+	#ifdef OCLBASE_DEBUG
+	fprintf(stderr, "~OCL_Base(): end\r\n");
+	#endif
 }
 
 /**
@@ -222,7 +231,7 @@ bool OCL_Base::OCL_UploadBuffer(cl_mem &buff_obj,
 	cl_int err;
 	
 	#ifdef OCLBASE_DEBUG
-	printf("uploading data to external device...");
+	fprintf(stderr, "uploading data to external device...");
 	#endif
 	
 	err = clEnqueueWriteBuffer(queue,
@@ -238,7 +247,7 @@ bool OCL_Base::OCL_UploadBuffer(cl_mem &buff_obj,
 	if(err != CL_SUCCESS)
 	{
 		#ifdef OCLBASE_DEBUG
-		printf("enqueing buffers failed: code = %i\r\n", err);
+		fprintf(stderr, "enqueing buffers failed: code = %i\r\n", err);
 		#endif
 		
 		return false;
@@ -247,7 +256,7 @@ bool OCL_Base::OCL_UploadBuffer(cl_mem &buff_obj,
 	else
 	{
 		#ifdef OCLBASE_DEBUG
-		printf("done\r\n");
+		fprintf(stderr, "done\r\n");
 		#endif
 	}
 	
@@ -273,7 +282,7 @@ bool OCL_Base::OCL_DownloadBuffer(cl_mem &buff_obj,
 	cl_int err;
 	
 	#ifdef OCLBASE_DEBUG
-	printf("downloading data from external device...");
+	fprintf(stderr, "downloading data from external device...");
 	#endif
 	
 	err = clEnqueueReadBuffer(queue,
@@ -289,7 +298,7 @@ bool OCL_Base::OCL_DownloadBuffer(cl_mem &buff_obj,
 	if(err != CL_SUCCESS)
 	{
 		#ifdef OCLBASE_DEBUG
-		printf("enqueing buffers failed: code = %i\r\n", err);
+		fprintf(stderr, "enqueing buffers failed: code = %i\r\n", err);
 		#endif
 		
 		return false;
@@ -298,7 +307,7 @@ bool OCL_Base::OCL_DownloadBuffer(cl_mem &buff_obj,
 	else
 	{
 		#ifdef OCLBASE_DEBUG
-		printf("done\r\n");
+		fprintf(stderr, "done\r\n");
 		#endif
 	}
 	
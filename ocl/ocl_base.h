@@ -46,7 +46,7 @@ using namespace std;
 class OCL_Base
 {
 public:
-	OCL_Base(string path);
+	OCL_Base(string path, string options = "");
 	~OCL_Base();
 	
 protected:
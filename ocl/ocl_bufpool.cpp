@@ -0,0 +1,285 @@
+/**************************************************************************//**
+* @file   ocl_bufpool.cpp
+* @brief  This source file implements the OpenCL device buffer pool.
+* @author Matthew Triche
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <vector>
+#include <assert.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "ocl_bufpool.h"
+
+using namespace std;
+
+/* ------------------------------------------------------------------------- *
+ * Define Constants                                                          *
+ * ------------------------------------------------------------------------- */
+
+// Uncomment to get debugging output.
+//#define OCLBUFPOOL_DEBUG
+
+#define POOL_MIN_CLASS   (4096) // smallest size class in bytes
+#define POOL_CLASS_STEPS (4)    // size classes per power of two
+
+/* ------------------------------------------------------------------------- *
+ * Define Methods                                                            *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief consturctor
+ *
+ * @param ctx The context in which buffers will be created.
+ */
+
+OCL_BufferPool::OCL_BufferPool(cl_context ctx)
+{
+	context    = ctx;
+	cur_bytes  = 0;
+	peak_bytes = 0;
+	max_bytes  = 0;
+	tick       = 0;
+}
+
+/**
+ * @brief destructor
+ *
+ * Every buffer object created by the pool is released, whether or not it
+ * was handed back with Release().
+ */
+
+OCL_BufferPool::~OCL_BufferPool()
+{
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		clReleaseMemObject(entries[i].buff);
+	}
+
+	entries.clear();
+	cur_bytes = 0;
+}
+
+/**
+ * @brief Round a requested size up to its size class.
+ *
+ * Each power of two is split into POOL_CLASS_STEPS classes, so at most a
+ * quarter of a buffer goes unused.
+ *
+ * @param size The requested size in bytes.
+ *
+ * @return The size class in bytes.
+ */
+
+size_t OCL_BufferPool::SizeClass(size_t size)
+{
+	size_t base = POOL_MIN_CLASS;
+	size_t step;
+
+	if(size <= POOL_MIN_CLASS)
+		return POOL_MIN_CLASS;
+
+	// find the power of two such that base < size <= 2*base
+	while((base << 1) < size)
+		base <<= 1;
+
+	step = base / POOL_CLASS_STEPS;
+
+	return ((size + step - 1) / step) * step;
+}
+
+/**
+ * @brief Get a buffer object of at least the requested size.
+ *
+ * The smallest unused buffer which fits is handed out. If none fits, a new
+ * buffer is created with the size rounded up to its size class.
+ *
+ * @param[in]  size       The required size in bytes.
+ * @param[out] p_capacity The actual size of the buffer (optional).
+ *
+ * @return The buffer object, or NULL if a new buffer could not be created.
+ */
+
+cl_mem OCL_BufferPool::Acquire(size_t size, size_t *p_capacity)
+{
+	cl_int err;
+	entry_t entry;
+	size_t best = entries.size();
+
+	tick++;
+
+	// look for the best fitting unused buffer
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		if(entries[i].in_use || (entries[i].size < size))
+			continue;
+
+		if((best == entries.size()) || (entries[i].size < entries[best].size))
+			best = i;
+	}
+
+	if(best != entries.size())
+	{
+		entries[best].in_use = true;
+		entries[best].used   = tick;
+
+		if(p_capacity)
+			*p_capacity = entries[best].size;
+
+		return entries[best].buff;
+	}
+
+	// nothing fits, so grow the pool
+	entry.size   = SizeClass(size);
+	entry.in_use = true;
+	entry.used   = tick;
+	entry.buff   = clCreateBuffer(context,
+	                              CL_MEM_READ_WRITE,
+	                              entry.size,
+	                              NULL, &err);
+
+	if(err != CL_SUCCESS)
+	{
+		#ifdef OCLBUFPOOL_DEBUG
+		fprintf(stderr, "creating pool buffer of %lu bytes failed: code = %i\r\n",
+		        (unsigned long)entry.size, err);
+		#endif
+
+		return NULL;
+	}
+
+	#ifdef OCLBUFPOOL_DEBUG
+	fprintf(stderr, "pool grew by %lu bytes\r\n", (unsigned long)entry.size);
+	#endif
+
+	entries.push_back(entry);
+
+	cur_bytes += entry.size;
+	if(cur_bytes > peak_bytes)
+		peak_bytes = cur_bytes;
+
+	if(p_capacity)
+		*p_capacity = entry.size;
+
+	return entry.buff;
+}
+
+/**
+ * @brief Hand a buffer object back to the pool for reuse.
+ *
+ * The buffer stays allocated on the device until it's trimmed (see
+ * SetLimit()), Purge() is called or the pool is destroyed.
+ *
+ * @param buff_obj A buffer object previously returned by Acquire().
+ */
+
+void OCL_BufferPool::Release(cl_mem buff_obj)
+{
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		if(entries[i].buff == buff_obj)
+		{
+			assert(entries[i].in_use); // buffer released twice
+			entries[i].in_use = false;
+			Trim();
+			return;
+		}
+	}
+
+	assert(false); // buffer doesn't belong to this pool
+}
+
+/**
+ * @brief Release every buffer object which isn't currently handed out.
+ */
+
+void OCL_BufferPool::Purge()
+{
+	size_t i = 0;
+
+	while(i < entries.size())
+	{
+		if(entries[i].in_use)
+		{
+			i++;
+			continue;
+		}
+
+		clReleaseMemObject(entries[i].buff);
+		cur_bytes -= entries[i].size;
+		entries.erase(entries.begin() + i);
+	}
+}
+
+/**
+ * @brief Set the high-water limit of the pool.
+ *
+ * Buffers which are handed out are never released, so the pool may still
+ * exceed the limit while they're in use.
+ *
+ * @param bytes The limit in bytes, or 0 to keep every idle buffer.
+ */
+
+void OCL_BufferPool::SetLimit(size_t bytes)
+{
+	max_bytes = bytes;
+	Trim();
+}
+
+/**
+ * @brief Release idle buffer objects, least recently used first, until the
+ *        pool is within its limit.
+ */
+
+void OCL_BufferPool::Trim()
+{
+	while((max_bytes != 0) && (cur_bytes > max_bytes))
+	{
+		size_t oldest = entries.size();
+
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			if(entries[i].in_use)
+				continue;
+
+			if((oldest == entries.size()) || (entries[i].used < entries[oldest].used))
+				oldest = i;
+		}
+
+		// everything left is handed out
+		if(oldest == entries.size())
+			break;
+
+		#ifdef OCLBUFPOOL_DEBUG
+		fprintf(stderr, "pool trimmed %lu bytes\r\n", (unsigned long)entries[oldest].size);
+		#endif
+
+		clReleaseMemObject(entries[oldest].buff);
+		cur_bytes -= entries[oldest].size;
+		entries.erase(entries.begin() + oldest);
+	}
+}
@@ -0,0 +1,88 @@
+/**************************************************************************//**
+ * @file   ocl_bufpool.h
+ * @brief  Header file for the OpenCL device buffer pool.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <vector>
+#include <stddef.h>
+
+using namespace std;
+
+#ifndef OCL_BUFPOOL_H_
+#define OCL_BUFPOOL_H_
+
+/* ------------------------------------------------------------------------- *
+ * Define External Types                                                     *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief A pool of OpenCL buffer objects which grows on demand.
+ *
+ * Requested sizes are rounded up to a size class, so buffers released after
+ * one call can be handed out again for a similarly sized request. If a limit
+ * is set, idle buffers are released, least recently used first, whenever
+ * the pool holds more than the limit. Every buffer created by the pool is
+ * released when the pool is destroyed.
+ */
+
+class OCL_BufferPool
+{
+public:
+	OCL_BufferPool(cl_context ctx);
+	~OCL_BufferPool();
+
+	cl_mem Acquire(size_t size, size_t *p_capacity = NULL);
+	void   Release(cl_mem buff_obj);
+	void   Purge();
+	void   SetLimit(size_t bytes);
+
+	size_t CurrentUsage() const { return cur_bytes; }
+	size_t PeakUsage() const { return peak_bytes; }
+
+	static size_t SizeClass(size_t size);
+
+private:
+	typedef struct POOL_ENTRY
+	{
+		cl_mem buff;   // buffer object
+		size_t size;   // allocated size in bytes (always a size class)
+		bool   in_use; // true while handed out by Acquire()
+		size_t used;   // value of 'tick' when last handed out
+	} entry_t;
+
+	void Trim();
+
+	cl_context      context;    // context which owns the buffers
+	vector<entry_t> entries;    // every buffer currently allocated
+	size_t          cur_bytes;  // bytes currently allocated on the device
+	size_t          peak_bytes; // high-water mark of cur_bytes
+	size_t          max_bytes;  // idle buffers are trimmed above this (0 for no limit)
+	size_t          tick;       // number of Acquire() calls so far
+};
+
+#endif
@@ -30,10 +30,14 @@
 
 #include <opencv2/opencv.hpp>
 #include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "ocl_ttrace.h"
 #include "ocl_base.h"
@@ -45,7 +49,9 @@ using namespace cv;
  * Define Constants                                                          *
  * ------------------------------------------------------------------------- */
 
-#define LOCAL_SIZE    (64)
+#define LOCAL_SIZE     (64)  // work-group size of whole-image traces
+#define LOCAL_SIZE_MAX (128) // must match LOCAL_SIZE_MAX in kernel.cl
+#define ROI_SEPARATOR (1) // blank rows between stacked regions of interest
 
 /* ------------------------------------------------------------------------- *
  * Define Types                                                          *
@@ -65,6 +71,119 @@ typedef struct __attribute__((__packed__)) TOKEN_ENTRY
 	uint32_t cx;    // current index in the contour table
 } token_t;
 
+/* ------------------------------------------------------------------------- *
+ * Declare Internal Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+static void or_reduce(const Mat &img_in, uint32_t factor, Mat &coarse);
+static bool contour_boxes(const Mat &ctbl, uint32_t cnt, vector<Rect> &boxes);
+static void merge_boxes(vector<Rect> &boxes);
+
+/* ------------------------------------------------------------------------- *
+ * Define Internal Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Downsample a binary image, keeping a pixel set if any pixel it
+ *        covers is set.
+ * 
+ * @param[in]  img_in Binary image (U8).
+ * @param[in]  factor Downsampling factor.
+ * @param[out] coarse Downsampled image (U8, 0 or 1).
+ */
+
+static void or_reduce(const Mat &img_in, uint32_t factor, Mat &coarse)
+{
+	coarse = Mat::zeros((img_in.rows + factor - 1) / factor,
+	                    (img_in.cols + factor - 1) / factor, CV_8U);
+	
+	for(int r = 0; r < img_in.rows; r++)
+	{
+		const uint8_t *p_src = img_in.ptr<uint8_t>(r);
+		uint8_t *p_dst = coarse.ptr<uint8_t>(r / factor);
+		
+		for(int c = 0; c < img_in.cols; c++)
+		{
+			p_dst[c / factor] |= p_src[c] ? 1 : 0;
+		}
+	}
+}
+
+/**
+ * @brief Get the bounding box of every traced contour.
+ * 
+ * @param[in]  ctbl  Contour table (S32) filled in by the kernel.
+ * @param[in]  cnt   Final value of the contour table counter.
+ * @param[out] boxes Bounding boxes in image coordinates.
+ * 
+ * @return False if a contour is missing, unterminated or truncated, in which
+ *         case the boxes can't be trusted to cover every component.
+ */
+
+static bool contour_boxes(const Mat &ctbl, uint32_t cnt, vector<Rect> &boxes)
+{
+	boxes.clear();
+	
+	// identifiers past the table's rows overwrote other contours
+	if(cnt > (uint32_t)ctbl.rows)
+		return false;
+	
+	for(uint32_t id = 0; id < cnt; id++)
+	{
+		const uint32_t *p_row = ctbl.ptr<uint32_t>(id);
+		uint32_t cx = p_row[0];
+		uint32_t r0 = UINT32_MAX, c0 = UINT32_MAX, r1 = 0, c1 = 0;
+		
+		if((cx < 3) || ((cx + 1) >= (uint32_t)ctbl.cols))
+			return false;
+		
+		for(uint32_t k = 1; (k + 1) < cx; k += 2)
+		{
+			r0 = min(r0, p_row[k]);
+			r1 = max(r1, p_row[k]);
+			c0 = min(c0, p_row[k+1]);
+			c1 = max(c1, p_row[k+1]);
+		}
+		
+		boxes.push_back(Rect(c0, r0, c1 - c0 + 1, r1 - r0 + 1));
+	}
+	
+	return true;
+}
+
+/**
+ * @brief Merge overlapping boxes until none overlap.
+ * 
+ * Afterwards, every component that has a pixel inside a box lies entirely
+ * within that box.
+ * 
+ * @param[in,out] boxes Bounding boxes.
+ */
+
+static void merge_boxes(vector<Rect> &boxes)
+{
+	bool merged = true;
+	
+	while(merged)
+	{
+		merged = false;
+		
+		for(size_t i = 0; i < boxes.size(); i++)
+		{
+			for(size_t j = i + 1; j < boxes.size(); j++)
+			{
+				if((boxes[i] & boxes[j]).area() > 0)
+				{
+					boxes[i] |= boxes[j];
+					boxes.erase(boxes.begin() + j);
+					merged = true;
+					j = i; // recheck against the grown box
+				}
+			}
+		}
+	}
+}
+
 /* ------------------------------------------------------------------------- *
  * Define Methods                                                            *
  * ------------------------------------------------------------------------- */
@@ -78,6 +197,8 @@ TimeProfile::TimeProfile()
 	ul_time = 0.0;
 	k_time  = 0.0;
 	dl_time = 0.0;
+	
+	memset(counters, 0, sizeof(counters));
 }
 
 /**
@@ -96,6 +217,13 @@ TimeProfile::TimeProfile(cl_event *ul_event,
 {
 	cl_ulong start, stop;
 	
+	// times of unspecified events are zero
+	ul_time = 0.0;
+	k_time  = 0.0;
+	dl_time = 0.0;
+	
+	memset(counters, 0, sizeof(counters));
+	
 	// if an upload event is specified
 	if(ul_event)
 	{
@@ -154,6 +282,8 @@ TimeProfile::TimeProfile(TimeProfile *tp)
 	ul_time = tp->ul_time;
 	k_time = tp->k_time;
 	dl_time = tp->dl_time;
+	
+	memcpy(counters, tp->counters, sizeof(counters));
 }
 
 /**
@@ -172,51 +302,116 @@ TimeProfile TimeProfile::operator+(TimeProfile &tp)
 	sum.k_time  = k_time + tp.k_time;
 	sum.dl_time = dl_time + tp.dl_time;
 	
+	for(int i = 0; i < TC_COUNT; i++)
+		sum.counters[i] = counters[i] + tp.counters[i];
+	
 	return sum;
 }
 
+/**
+ * @brief Get the name of a hot-path counter.
+ * 
+ * @param i Counter index (TC_*).
+ * 
+ * @return The counter's name, or NULL if the index is out of range.
+ */
+
+const char *TimeProfile::CounterName(int i)
+{
+	static const char *names[TC_COUNT] = {
+#define TC_NAME(id, name) name,
+		TTRACE_COUNTER_LIST(TC_NAME)
+#undef TC_NAME
+	};
+	
+	if((i < 0) || (i >= TC_COUNT))
+		return NULL;
+	
+	return names[i];
+}
+
 /**
  * @brief consturctor
  * 
- * @param path       Path to the OCL source file.
- * @param img_width  Image width.
- * @param img_height Image height.
+ * The image and contour table dimensions only pre-size the device buffers.
+ * Trace() grows them on demand when it receives larger inputs.
+ * 
+ * If the autotuning profile (TUNE_PROFILE_PATH) has entries for this
+ * device, StreamBandRows() returns the band height tuned for the nearest
+ * image width.
+ * 
+ * @param path        Path to the OCL source file.
+ * @param img_width   Expected image width.
+ * @param img_height  Expected image height.
+ * @param ctbl_width  Expected contour table width.
+ * @param ctbl_height Expected contour table height.
+ * @param options     Build options passed to the OCL compiler.
+ * @param counters    If true, the kernel collects the hot-path counters
+ *                    and each launch fills in TimeProfile::counters.
  */
 
 OCL_TTrace::OCL_TTrace(string path, 
                        uint32_t img_width,
                        uint32_t img_height,
                        uint32_t ctbl_width,
-                       uint32_t ctbl_height) : OCL_Base(path)
+                       uint32_t ctbl_height,
+                       string options,
+                       bool counters) : OCL_Base(path, BuildOptions(options, counters)), pool(context)
 {
 	cl_int err;
+	cl_mem cl_m_binimg, cl_m_tokens, cl_m_ctbl;
+	cl_kernel kernels[4];
+	
+	counters_on = counters;
 	
-	cl_m_binimg = clCreateBuffer(context,
-	                             CL_MEM_READ_WRITE,
-	                             img_height*img_width, 
-	                             NULL, &err);
-	assert(err == CL_SUCCESS); // failed to create buffer object
-	
-	cl_m_tokens = clCreateBuffer(context,
-	                             CL_MEM_READ_WRITE,
-	                             img_height*sizeof(token_t), 
-	                             NULL, &err);
-	assert(err == CL_SUCCESS); // failed to create buffer object
-	
-	cl_m_cnt = clCreateBuffer(context,
-	                          CL_MEM_READ_WRITE,
-	                          sizeof(uint32_t), 
-	                          NULL, &err);
-	assert(err == CL_SUCCESS); // failed to create buffer object
-	
-	cl_m_ctbl = clCreateBuffer(context,
-	                           CL_MEM_READ_WRITE,
-	                           sizeof(uint32_t)*ctbl_width*ctbl_height, 
-	                           NULL, &err);
-	assert(err == CL_SUCCESS); // failed to create buffer object
-
 	cl_k_ttrace = clCreateKernel(program, "TOKEN_TRACE", &err);
 	assert(err == CL_SUCCESS); // failed to create kernel
+	
+	cl_k_lfill = clCreateKernel(program, "LABEL_FILL", &err);
+	assert(err == CL_SUCCESS); // failed to create kernel
+	
+	cl_k_llink = clCreateKernel(program, "LABEL_LINK", &err);
+	assert(err == CL_SUCCESS); // failed to create kernel
+	
+	cl_k_lresolve = clCreateKernel(program, "LABEL_RESOLVE", &err);
+	assert(err == CL_SUCCESS); // failed to create kernel
+	
+	// every kernel is launched with the same work-group size
+	kernels[0] = cl_k_ttrace;
+	kernels[1] = cl_k_lfill;
+	kernels[2] = cl_k_llink;
+	kernels[3] = cl_k_lresolve;
+	max_lsize  = LOCAL_SIZE_MAX;
+	
+	for(int i = 0; i < 4; i++)
+	{
+		size_t wg_size;
+		
+		err = clGetKernelWorkGroupInfo(kernels[i], device_id, CL_KERNEL_WORK_GROUP_SIZE,
+		                               sizeof(wg_size), &wg_size, NULL);
+		assert(err == CL_SUCCESS); // failed to query the kernel
+		
+		max_lsize = min(max_lsize, wg_size);
+	}
+	
+	trace_lsize  = min((size_t)LOCAL_SIZE, max_lsize);
+	trace_cnt    = 0;
+	cl_m_sctbl   = NULL;
+	device_key   = DeviceKey();
+	profile.Load(TUNE_PROFILE_PATH); // an untuned setup has no profile
+	
+	cl_m_cnt = pool.Acquire(sizeof(uint32_t));
+	assert(cl_m_cnt != NULL); // failed to create buffer object
+	
+	// pre-size the pool by acquiring a full set of buffers once
+	cl_m_binimg = pool.Acquire((size_t)img_height*img_width);
+	cl_m_tokens = pool.Acquire(GlobalSize(img_height, trace_lsize)*sizeof(token_t));
+	cl_m_ctbl   = pool.Acquire(sizeof(uint32_t)*ctbl_width*ctbl_height);
+	assert(cl_m_binimg && cl_m_tokens && cl_m_ctbl); // failed to create buffer objects
+	
+	pool.Release(cl_m_binimg);
+	pool.Release(cl_m_tokens);
+	pool.Release(cl_m_ctbl);
 };
 
 /**
@@ -225,42 +420,666 @@ OCL_TTrace::OCL_TTrace(string path,
 
 OCL_TTrace::~OCL_TTrace()
 {
-	clReleaseMemObject(cl_m_binimg);
+	clReleaseKernel(cl_k_ttrace);
+	clReleaseKernel(cl_k_lfill);
+	clReleaseKernel(cl_k_llink);
+	clReleaseKernel(cl_k_lresolve);
+	
+	// the pool releases every buffer object when it's destroyed
+	StreamEnd();
+	pool.Release(cl_m_cnt);
 }
 
+/**
+ * @brief Get the key which identifies this device in the tuning profile.
+ * 
+ * @return The device name, compute units and global memory cache size.
+ */
+
+string OCL_TTrace::DeviceKey() const
+{
+	char name[256] = "";
+	cl_uint n_units = 0;
+	cl_ulong cache_size = 0;
+	ostringstream key;
+	
+	clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(name)-1, name, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(n_units), &n_units, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(cache_size), &cache_size, NULL);
+	
+	key << name << ", " << n_units << " CUs, " << cache_size << " B cache";
+	
+	return key.str();
+}
+
+/**
+ * @brief Get the number of image rows to trace per streamed band.
+ * 
+ * @param img_cols Number of image columns.
+ * 
+ * @return The band height tuned for the nearest image width, else the
+ *         tallest band one work-group can trace (MaxLocalSize()-1).
+ */
+
+uint32_t OCL_TTrace::StreamBandRows(uint32_t img_cols) const
+{
+	uint32_t band_rows = profile.Lookup(device_key, img_cols);
+	
+	if((band_rows == 0) || (band_rows >= max_lsize))
+		band_rows = max_lsize - 1;
+	
+	return band_rows;
+}
+
+/**
+ * @brief Add the kernel's build options for the hot-path counters.
+ * 
+ * The TC_* indices are always defined, so the kernel and the host share
+ * TTRACE_COUNTER_LIST. TTRACE_COUNTERS turns the counting on.
+ * 
+ * @param options  Caller's build options.
+ * @param counters If true, define TTRACE_COUNTERS.
+ * 
+ * @return The complete build options.
+ */
+
+string OCL_TTrace::BuildOptions(const string &options, bool counters)
+{
+	ostringstream opts;
+	
+	opts << options;
+	
+	if(counters)
+		opts << " -D TTRACE_COUNTERS";
+	
+#define TC_OPTION(id, name) opts << " -D " #id "=" << (int)id;
+	TTRACE_COUNTER_LIST(TC_OPTION)
+#undef TC_OPTION
+	
+	opts << " -D TC_COUNT=" << (int)TC_COUNT;
+	
+	return opts.str();
+}
+
+/**
+ * @brief Get the terminated contours of a table in a canonical order.
+ * 
+ * Contour identifiers depend on the order in which PEs reach the counter
+ * (and on the regions traced by TracePyramid()), so results are compared
+ * as sorted sets of contours.
+ * 
+ * @param ctbl Contour table (S32).
+ * 
+ * @return The contours' points, sorted.
+ */
+
+vector< vector<uint32_t> > OCL_TTrace::SortedContours(const Mat &ctbl)
+{
+	vector< vector<uint32_t> > contours;
+	
+	for(int row = 0; row < ctbl.rows; row++)
+	{
+		const uint32_t *p_row = ctbl.ptr<uint32_t>(row);
+		uint32_t cx = min(p_row[0], (uint32_t)ctbl.cols);
+		
+		if(cx == 0)
+			continue;
+		
+		contours.push_back(vector<uint32_t>(p_row + 1, p_row + cx));
+	}
+	
+	sort(contours.begin(), contours.end());
+	
+	return contours;
+}
+
+/**
+ * @brief Get the global work size needed to trace an image.
+ * 
+ * One PE is launched per image row, padded up to a multiple of the
+ * local size.
+ * 
+ * @param img_rows Number of image rows.
+ * @param lsize    Local size.
+ * 
+ * @return The global work size.
+ */
+
+size_t OCL_TTrace::GlobalSize(uint32_t img_rows, size_t lsize)
+{
+	size_t gsize = img_rows;
+	
+	gsize += lsize - (gsize%lsize);
+	
+	return gsize;
+}
+
+/**
+ * @brief Trace the contours of a binary image.
+ * 
+ * Each contour's points go to the table row of its identifier. Contours
+ * started after the table's rows ran out are dropped. TraceCount() tells how
+ * many identifiers were handed out, so any excess over the table's rows is
+ * the number of contours lost.
+ * 
+ * @param[in]  img_in Binary image (U8, continuous).
+ * @param[out] ctbl   Contour table (S32, continuous).
+ * @param[out] tp     Time profile of the transfers and kernel execution.
+ */
+
 void OCL_TTrace::Trace(const Mat &img_in, Mat &ctbl, TimeProfile &tp)
+{
+	trace_cnt = 0; // the initial counter value
+	
+	Launch(img_in, 0, &ctbl, &trace_cnt, false, NULL, NULL, tp);
+}
+
+/**
+ * @brief Trace the contours of a binary image and label its components.
+ * 
+ * The label image is derived on the device from the traced contours, so
+ * the image is only uploaded once. Each foreground pixel gets the label of
+ * its component (an arbitrary positive value), and background pixels get 0.
+ * Components are 8-connected, the same as cv::connectedComponents() with
+ * connectivity 8. Runs of pixels are linked to their neighbours in the row
+ * above as well as through the contours, so components whose contours
+ * didn't fit in the contour table are still labelled.
+ * 
+ * @param[in]  img_in Binary image (U8, continuous).
+ * @param[out] ctbl   Contour table (S32, continuous).
+ * @param[out] labels Label image (S32), allocated to the size of 'img_in'.
+ * @param[out] tp     Time profile of the transfers and kernel executions.
+ */
+
+void OCL_TTrace::Trace(const Mat &img_in, Mat &ctbl, Mat &labels, TimeProfile &tp)
+{
+	trace_cnt = 0; // the initial counter value
+	
+	labels.create(img_in.rows, img_in.cols, CV_32S);
+	
+	Launch(img_in, 0, &ctbl, &trace_cnt, false, &labels, NULL, tp);
+}
+
+/**
+ * @brief Trace the iso-contours of a grayscale image at several levels.
+ * 
+ * The image is uploaded once and every level is traced by its own set of
+ * PEs in a single launch. At each level, pixels greater than the level's
+ * threshold are foreground, the same as cv::threshold() with THRESH_BINARY.
+ * 
+ * @param[in]     img_in     Grayscale image (U8, continuous).
+ * @param[in]     thresholds Threshold of each level.
+ * @param[in,out] ctbls      One contour table (S32) per threshold, all the
+ *                           same size.
+ * @param[out]    counts     Number of contours started at each level. Contours
+ *                           past a table's last row were dropped (see Trace()).
+ *                           TraceCount() returns the largest of them.
+ * @param[out]    tp         Time profile of the transfers and kernel execution.
+ */
+
+void OCL_TTrace::Trace(const Mat &img_in, const vector<uint8_t> &thresholds,
+                       vector<Mat> &ctbls, vector<uint32_t> &counts, TimeProfile &tp)
+{
+	int ctbl_rows, ctbl_cols;
+	Mat ctbl;
+	
+	assert(!thresholds.empty() && (ctbls.size() == thresholds.size()));
+	
+	ctbl_rows = ctbls[0].rows;
+	ctbl_cols = ctbls[0].cols;
+	
+	// the kernel expects the levels' contour tables one after the other
+	ctbl.create(ctbl_rows*thresholds.size(), ctbl_cols, CV_32S);
+	
+	for(size_t i = 0; i < ctbls.size(); i++)
+	{
+		assert((ctbls[i].rows == ctbl_rows) && (ctbls[i].cols == ctbl_cols));
+		
+		Mat dst = ctbl.rowRange(i*ctbl_rows, (i+1)*ctbl_rows);
+		ctbls[i].copyTo(dst);
+	}
+	
+	counts.assign(thresholds.size(), 0); // the initial counter values
+	
+	Launch(img_in, 0, &ctbl, &counts[0], false, NULL, &thresholds, tp);
+	
+	// a level overflowed its table if the largest count did
+	trace_cnt = *max_element(counts.begin(), counts.end());
+	
+	for(size_t i = 0; i < ctbls.size(); i++)
+	{
+		ctbl.rowRange(i*ctbl_rows, (i+1)*ctbl_rows).copyTo(ctbls[i]);
+	}
+}
+
+/**
+ * @brief Trace the contours of a mostly empty binary image coarse-to-fine.
+ * 
+ * A copy of the image downsampled by 'factor' (a coarse pixel is set if any
+ * pixel it covers is set) is traced first. The bounding boxes of the coarse
+ * contours are merged until none overlap, so each one holds whole
+ * components. Those regions are then stacked top to bottom, each followed
+ * by a blank row, and traced at full resolution in a single launch. The points
+ * are mapped back to image coordinates, so 'ctbl' has the same meaning as
+ * after Trace(), although contour identifiers may be numbered differently.
+ * 
+ * If the coarse trace can't be trusted (its contours overflowed or were
+ * truncated in a table the size of 'ctbl') or the regions cover as much
+ * area as the image, the whole image is traced instead.
+ * 
+ * @param[in]  img_in Binary image (U8, continuous).
+ * @param[in]  factor Downsampling factor of the coarse image (> 1).
+ * @param[out] ctbl   Contour table (S32, continuous).
+ * @param[out] tp     Time profile of both passes.
+ */
+
+void OCL_TTrace::TracePyramid(const Mat &img_in, uint32_t factor, Mat &ctbl, TimeProfile &tp)
+{
+	TimeProfile tp_coarse;
+	Mat coarse, coarse_ctbl, stacked;
+	vector<Rect> boxes;
+	vector<int> offset; // stacked row of each region's first row
+	uint32_t cnt = 0;
+	int stacked_rows = 0, stacked_cols = 0;
+	
+	assert(factor > 1);
+	
+	/* ------ Coarse Pass ------ */
+	
+	or_reduce(img_in, factor, coarse);
+	
+	coarse_ctbl = Mat::zeros(ctbl.rows, ctbl.cols, CV_32S);
+	Launch(coarse, 0, &coarse_ctbl, &cnt, false, NULL, NULL, tp_coarse);
+	
+	if(!contour_boxes(coarse_ctbl, cnt, boxes))
+	{
+		Trace(img_in, ctbl, tp);
+		tp = tp + tp_coarse;
+		return;
+	}
+	
+	if(boxes.empty())
+	{
+		// the image is empty
+		ctbl.setTo(Scalar(0));
+		trace_cnt = 0;
+		tp = tp_coarse;
+		return;
+	}
+	
+	merge_boxes(boxes);
+	
+	/* ------ Stack the Regions ------ */
+	
+	for(size_t i = 0; i < boxes.size(); i++)
+	{
+		// scale up to full resolution, clipped to the image
+		boxes[i] = Rect(boxes[i].x*factor, boxes[i].y*factor,
+		                boxes[i].width*factor, boxes[i].height*factor) &
+		           Rect(0, 0, img_in.cols, img_in.rows);
+		
+		offset.push_back(stacked_rows);
+		stacked_rows += boxes[i].height + ROI_SEPARATOR;
+		stacked_cols  = max(stacked_cols, boxes[i].width);
+	}
+	
+	/* NOTE: A contour is only closed by the PE of the row below it, so the
+	 * last region keeps its blank row too, unless the image has no row
+	 * below it either.
+	 */
+	if((boxes.back().y + boxes.back().height) == img_in.rows)
+	{
+		stacked_rows -= ROI_SEPARATOR;
+	}
+	
+	if((double)stacked_rows*stacked_cols >= (double)img_in.rows*img_in.cols)
+	{
+		Trace(img_in, ctbl, tp);
+		tp = tp + tp_coarse;
+		return;
+	}
+	
+	stacked = Mat::zeros(stacked_rows, stacked_cols, CV_8U);
+	
+	for(size_t i = 0; i < boxes.size(); i++)
+	{
+		Mat dst = stacked(Rect(0, offset[i], boxes[i].width, boxes[i].height));
+		img_in(boxes[i]).copyTo(dst);
+	}
+	
+	/* ------ Fine Pass ------ */
+	
+	trace_cnt = 0;
+	Launch(stacked, 0, &ctbl, &trace_cnt, false, NULL, NULL, tp);
+	tp = tp + tp_coarse;
+	
+	// map the points back to image coordinates
+	for(int row = 0; row < ctbl.rows; row++)
+	{
+		uint32_t *p_row = ctbl.ptr<uint32_t>(row);
+		uint32_t cx = min(p_row[0], (uint32_t)ctbl.cols);
+		
+		for(uint32_t k = 1; (k + 1) < cx; k += 2)
+		{
+			// find the last region starting at or above the point
+			size_t i = upper_bound(offset.begin(), offset.end(), (int)p_row[k]) - offset.begin() - 1;
+			
+			p_row[k]   = p_row[k] - offset[i] + boxes[i].y;
+			p_row[k+1] = p_row[k+1] + boxes[i].x;
+		}
+	}
+}
+
+/**
+ * @brief Start tracing an image in horizontal bands.
+ * 
+ * The contour table stays on the device until StreamEnd(), so bands don't
+ * transfer it. Its rows are read back with StreamLengths() and StreamRow().
+ * 
+ * @param img_cols  Image width.
+ * @param ctbl_rows Contour table rows.
+ * @param ctbl_cols Contour table columns.
+ */
+
+void OCL_TTrace::StreamBegin(uint32_t img_cols, uint32_t ctbl_rows, uint32_t ctbl_cols)
+{
+	cl_int err;
+	uint32_t zero = 0;
+	size_t ctbl_bytes = sizeof(uint32_t)*ctbl_rows*ctbl_cols;
+	
+	// no tokens enter the first band
+	carry.assign((size_t)img_cols*sizeof(token_t), 0);
+	stream_cnt = 0;
+	
+	StreamEnd();
+	
+	cl_m_sctbl = pool.Acquire(ctbl_bytes);
+	assert(cl_m_sctbl != NULL); // failed to create buffer object
+	
+	// a row is unterminated while its column 0 is 0
+	err = clEnqueueFillBuffer(queue, cl_m_sctbl, &zero, sizeof(zero), 0, ctbl_bytes,
+	                          0, NULL, NULL);
+	assert(err == CL_SUCCESS); // failed to clear the contour table
+	
+	stream_rows = ctbl_rows;
+	stream_cols = ctbl_cols;
+}
+
+/**
+ * @brief Release the contour table of the image being streamed.
+ */
+
+void OCL_TTrace::StreamEnd()
+{
+	if(cl_m_sctbl)
+	{
+		pool.Release(cl_m_sctbl);
+		cl_m_sctbl = NULL;
+	}
+}
+
+/**
+ * @brief Download column 0 of every row of the streamed contour table.
+ * 
+ * Column 0 is 0 while a row's newest contour is open, and one past its last
+ * written column once it's terminated.
+ * 
+ * @param[out]    lengths Column 0 of each row.
+ * @param[in,out] tp      Time profile, the download time is added to it.
+ */
+
+void OCL_TTrace::StreamLengths(vector<uint32_t> &lengths, TimeProfile &tp)
+{
+	cl_int err;
+	cl_event dl_event;
+	size_t origin[3] = { 0, 0, 0 };
+	size_t region[3] = { sizeof(uint32_t), stream_rows, 1 };
+	
+	assert(cl_m_sctbl != NULL); // StreamBegin() not called
+	
+	lengths.resize(stream_rows);
+	
+	// one entry per row, strided by the table width
+	err = clEnqueueReadBufferRect(queue, cl_m_sctbl, CL_TRUE, origin, origin, region,
+	                              sizeof(uint32_t)*stream_cols, 0,
+	                              sizeof(uint32_t), 0,
+	                              &lengths[0], 0, NULL, &dl_event);
+	assert(err == CL_SUCCESS); // failed to download column 0
+	
+	tp.dl_time += TimeProfile(NULL, NULL, &dl_event).dl_time;
+	clReleaseEvent(dl_event);
+}
+
+/**
+ * @brief Download the start of one row of the streamed contour table.
+ * 
+ * @param[in]     row  Table row.
+ * @param[in]     n    Number of columns to download (see StreamLengths()).
+ * @param[out]    dst  Row (1 x table columns, S32). Columns from 'n' on are
+ *                     left unset.
+ * @param[in,out] tp   Time profile, the download time is added to it.
+ */
+
+void OCL_TTrace::StreamRow(uint32_t row, uint32_t n, Mat &dst, TimeProfile &tp)
+{
+	cl_int err;
+	cl_event dl_event;
+	
+	assert(cl_m_sctbl != NULL); // StreamBegin() not called
+	assert((row < stream_rows) && (n <= stream_cols));
+	
+	dst.create(1, stream_cols, CV_32S);
+	
+	err = clEnqueueReadBuffer(queue, cl_m_sctbl, CL_TRUE,
+	                          sizeof(uint32_t)*row*stream_cols, sizeof(uint32_t)*n,
+	                          dst.data, 0, NULL, &dl_event);
+	assert(err == CL_SUCCESS); // failed to download the row
+	
+	tp.dl_time += TimeProfile(NULL, NULL, &dl_event).dl_time;
+	clReleaseEvent(dl_event);
+}
+
+/**
+ * @brief Trace the next horizontal band of an image.
+ * 
+ * Bands must be traced top to bottom. Every band after the first starts
+ * with one halo row, which is a copy of the previous band's last row.
+ * Tokens passed out of a band's last row and the contour counter carry over
+ * to the next band. A band may hold at most MaxLocalSize()-1 rows, since the
+ * kernel only passes tokens safely within one work-group, and is launched
+ * as a single work-group one PE taller than the band. StreamBandRows()
+ * gives the fastest band height for this device. Contour
+ * identifiers index the contour table modulo its row count, and a row is
+ * reused by the contour whose identifier comes round to it.
+ * 
+ * @param[in]  band     Band of the binary image (U8, continuous).
+ * @param[in]  row_base Image row of the band's first (non-halo) row.
+ * @param[out] tp       Time profile of the transfers and kernel execution.
+ */
+
+void OCL_TTrace::StreamBand(const Mat &band, uint32_t row_base, TimeProfile &tp)
+{
+	const token_t *p_out;
+	token_t *p_in;
+	uint32_t cols = band.cols;
+	
+	assert(carry.size() == (size_t)cols*sizeof(token_t)); // StreamBegin() not called
+	assert((row_base == 0) || (band.rows > 1)); // a band needs more than a halo row
+	
+	Launch(band, row_base, NULL, &stream_cnt, true, NULL, NULL, tp);
+	
+	/* NOTE: A token passed at column c is received by the next row at
+	 * column c-1. The next row is stalled while its upper neighbour handles
+	 * column 0, so it only sees that token if none was passed at column 1.
+	 */
+	vector<uint8_t> out(carry);
+	
+	p_out = (const token_t*)&out[0];
+	p_in  = (token_t*)&carry[0];
+	
+	for(uint32_t c = 0; c < cols; c++)
+	{
+		if((c+1) < cols)
+			p_in[c] = p_out[c+1];
+		else
+			p_in[c].state = 0;
+	}
+	
+	if((cols > 1) && !p_in[0].state)
+		p_in[0] = p_out[0];
+}
+
+/**
+ * @brief Upload an image, run the token-trace kernel and download the results.
+ * 
+ * @param[in]     img_in   Binary image or band (U8, continuous).
+ * @param[in]     row_base Image row of the first traced row (see StreamBand()).
+ * @param[in,out] p_ctbl   Contour table (S32, continuous), or NULL while
+ *                         streaming, which uses the table on the device.
+ * @param[in,out] p_cnt    Contour table counter of each level.
+ * @param[in]     stream   If true, pass tokens through the carry buffers.
+ * @param[out]    p_labels Label image (S32, continuous), or NULL to skip labelling.
+ * @param[in]     p_thresholds Threshold of each level, or NULL to trace a
+ *                binary image. With N levels, 'ctbl' holds N contour tables
+ *                one after the other and 'p_cnt' points to N counters.
+ * @param[out]    tp       Time profile of the transfers and kernel execution.
+ */
+
+void OCL_TTrace::Launch(const Mat &img_in, uint32_t row_base, Mat *p_ctbl,
+                        uint32_t *p_cnt, bool stream, Mat *p_labels,
+                        const vector<uint8_t> *p_thresholds, TimeProfile &tp)
 {
 	cl_int err;
-	cl_event ul_event, k_event, dl_event;
+	cl_event ul_event, k_event, dl_event, ctbl_event;
+	TimeProfile tp_labels;
+	cl_mem cl_m_binimg, cl_m_tokens, cl_m_ctbl;
+	cl_mem cl_m_cin = NULL, cl_m_cout = NULL;
+	cl_mem cl_m_labels = NULL, cl_m_parent = NULL;
+	cl_mem cl_m_stats = NULL;
+	cl_mem cl_m_thresh = NULL, cl_m_counts = cl_m_cnt;
+	cl_ulong stats[TC_COUNT] = { 0 };
 	
-	uint32_t img_rows  = img_in.rows;
+	// a band after the first starts with a halo row which isn't traced
+	uint32_t img_rows  = img_in.rows - ((row_base != 0) ? 1 : 0);
 	uint32_t img_cols  = img_in.cols;
-	uint32_t ctbl_rows = ctbl.rows;
-	uint32_t ctbl_cols = ctbl.cols;
-	uint32_t cnt_init  = 0; // the initial counter value
+	uint32_t n_levels  = p_thresholds ? p_thresholds->size() : 1;
+	uint32_t ctbl_rows = stream ? stream_rows : p_ctbl->rows / n_levels;
+	uint32_t ctbl_cols = stream ? stream_cols : p_ctbl->cols;
+	
+	// each level gets its own whole work-groups
+	// a band is traced by a single work-group, one PE taller (see StreamBand())
+	size_t lsize = stream ? (size_t)img_rows + 1 : trace_lsize; // local size
+	size_t gsize = GlobalSize(img_rows, lsize)*n_levels; // group size
+	
+	size_t img_bytes   = (size_t)img_in.rows*img_cols;
+	size_t ctbl_bytes  = sizeof(uint32_t)*ctbl_rows*n_levels*ctbl_cols;
+	size_t carry_bytes = sizeof(token_t)*img_cols;
+	size_t label_bytes = sizeof(uint32_t)*img_rows*img_cols;
+	size_t cnt_bytes   = sizeof(uint32_t)*n_levels;
+	
+	assert(img_in.type() == CV_8UC1 && img_in.isContinuous());
+	assert(lsize <= max_lsize); // band too tall for one work-group
+	assert(stream ? (cl_m_sctbl != NULL) : (p_ctbl != NULL)); // no contour table
+	assert(stream || (p_ctbl->type() == CV_32SC1 && p_ctbl->isContinuous()));
+	
+	// every PE in the padded range touches its own token entry
+	cl_m_binimg = pool.Acquire(img_bytes);
+	cl_m_tokens = pool.Acquire(gsize*sizeof(token_t));
+	cl_m_ctbl   = stream ? cl_m_sctbl : pool.Acquire(ctbl_bytes);
+	assert(cl_m_binimg && cl_m_tokens && cl_m_ctbl); // failed to create buffer objects
 	
-	size_t gsize = img_rows; // group size
-	gsize += LOCAL_SIZE - (gsize%LOCAL_SIZE);
+	if(stream)
+	{
+		cl_m_cout = pool.Acquire(carry_bytes);
+		assert(cl_m_cout != NULL); // failed to create buffer object
+		
+		// the first band doesn't receive any tokens
+		if(row_base != 0)
+		{
+			cl_m_cin = pool.Acquire(carry_bytes);
+			assert(cl_m_cin != NULL); // failed to create buffer object
+		}
+	}
+	
+	if(p_thresholds)
+	{
+		// levels are only supported for whole images
+		assert(!stream && !p_labels && (p_ctbl->rows % n_levels == 0));
+		
+		cl_m_thresh = pool.Acquire(n_levels);
+		cl_m_counts = pool.Acquire(cnt_bytes);
+		assert(cl_m_thresh && cl_m_counts); // failed to create buffer objects
+	}
+	
+	if(p_labels)
+	{
+		// labels use image coordinates, which bands don't have
+		assert(!stream);
+		assert(p_labels->type() == CV_32SC1 && p_labels->isContinuous());
+		
+		cl_m_labels = pool.Acquire(label_bytes);
+		// contour labels, then one label per pixel for runs without one
+		cl_m_parent = pool.Acquire(sizeof(uint32_t)*(ctbl_rows+1) + label_bytes);
+		assert(cl_m_labels && cl_m_parent); // failed to create buffer objects
+	}
 	
-	size_t lsize = LOCAL_SIZE; // local size
+	if(counters_on)
+	{
+		cl_m_stats = pool.Acquire(sizeof(stats));
+		assert(cl_m_stats != NULL); // failed to create buffer object
+		
+		OCL_UploadBuffer(cl_m_stats, stats, sizeof(stats), NULL);
+	}
 	
 	// upload the image
-	OCL_UploadBuffer(cl_m_binimg, img_in.data, img_in.rows*img_in.cols, &ul_event);
+	OCL_UploadBuffer(cl_m_binimg, img_in.data, img_bytes, &ul_event);
 	
-	// initialize the counter for the contour table
-	OCL_UploadBuffer(cl_m_cnt, &cnt_init, sizeof(uint32_t), &ul_event);
+	if(p_labels)
+	{
+		uint32_t zero = 0;
+		vector<uint32_t> parent(ctbl_rows+1);
+		
+		// every label starts out as its own set
+		for(uint32_t i = 0; i <= ctbl_rows; i++)
+			parent[i] = i;
+		
+		OCL_UploadBuffer(cl_m_parent, &parent[0], sizeof(uint32_t)*parent.size(), NULL);
+		
+		err = clEnqueueFillBuffer(queue, cl_m_labels, &zero, sizeof(zero), 0, label_bytes,
+		                          0, NULL, NULL);
+		assert(err == CL_SUCCESS); // failed to clear the label image
+	}
+	
+	if(p_thresholds)
+		OCL_UploadBuffer(cl_m_thresh, (void*)&(*p_thresholds)[0], n_levels, NULL);
+	
+	// initialize the counter of each contour table
+	OCL_UploadBuffer(cl_m_counts, p_cnt, cnt_bytes, NULL);
 	
 	// upload the contour table (optional)
-	OCL_UploadBuffer(cl_m_ctbl, ctbl.data, sizeof(uint32_t)*ctbl_rows*ctbl_cols, &ul_event);
+	if(!stream)
+		OCL_UploadBuffer(cl_m_ctbl, p_ctbl->data, ctbl_bytes, &ctbl_event);
+	
+	// upload the tokens entering the band
+	if(cl_m_cin)
+		OCL_UploadBuffer(cl_m_cin, &carry[0], carry_bytes, NULL);
 	
 	err  = clSetKernelArg(cl_k_ttrace, 0, sizeof(cl_mem),   &cl_m_binimg);
 	err |= clSetKernelArg(cl_k_ttrace, 1, sizeof(cl_mem),   &cl_m_tokens);
 	err |= clSetKernelArg(cl_k_ttrace, 2, sizeof(uint32_t), &img_rows);
 	err |= clSetKernelArg(cl_k_ttrace, 3, sizeof(uint32_t), &img_cols);
-	err |= clSetKernelArg(cl_k_ttrace, 4, sizeof(cl_mem),   &cl_m_cnt);
+	err |= clSetKernelArg(cl_k_ttrace, 4, sizeof(cl_mem),   &cl_m_counts);
 	err |= clSetKernelArg(cl_k_ttrace, 5, sizeof(cl_mem),   &cl_m_ctbl);
 	err |= clSetKernelArg(cl_k_ttrace, 6, sizeof(uint32_t), &ctbl_rows);
 	err |= clSetKernelArg(cl_k_ttrace, 7, sizeof(uint32_t), &ctbl_cols);
+	err |= clSetKernelArg(cl_k_ttrace, 8, sizeof(uint32_t), &row_base);
+	err |= clSetKernelArg(cl_k_ttrace, 9, sizeof(cl_mem),   cl_m_cin ? &cl_m_cin : NULL);
+	err |= clSetKernelArg(cl_k_ttrace,10, sizeof(cl_mem),   cl_m_cout ? &cl_m_cout : NULL);
+	err |= clSetKernelArg(cl_k_ttrace,11, sizeof(cl_mem),   cl_m_labels ? &cl_m_labels : NULL);
+	err |= clSetKernelArg(cl_k_ttrace,12, sizeof(cl_mem),   cl_m_parent ? &cl_m_parent : NULL);
+	err |= clSetKernelArg(cl_k_ttrace,13, sizeof(cl_mem),   cl_m_stats ? &cl_m_stats : NULL);
+	err |= clSetKernelArg(cl_k_ttrace,14, sizeof(cl_mem),   cl_m_thresh ? &cl_m_thresh : NULL);
+	err |= clSetKernelArg(cl_k_ttrace,15, sizeof(uint32_t), &n_levels);
 	assert(err == CL_SUCCESS); // failed to set arguments
 
 	err = clEnqueueNDRangeKernel(queue, 
@@ -274,13 +1093,113 @@ void OCL_TTrace::Trace(const Mat &img_in, Mat &ctbl, TimeProfile &tp)
 	                             &k_event); 
 	assert(err == CL_SUCCESS); // failed to execute kernel
 
+	if(p_labels)
+	{
+		cl_event lf_event, ll_event, lr_event, ldl_event;
+		uint32_t label_base = ctbl_rows+1;
+		
+		err  = clSetKernelArg(cl_k_lfill, 0, sizeof(cl_mem),   &cl_m_binimg);
+		err |= clSetKernelArg(cl_k_lfill, 1, sizeof(uint32_t), &img_rows);
+		err |= clSetKernelArg(cl_k_lfill, 2, sizeof(uint32_t), &img_cols);
+		err |= clSetKernelArg(cl_k_lfill, 3, sizeof(cl_mem),   &cl_m_labels);
+		err |= clSetKernelArg(cl_k_lfill, 4, sizeof(cl_mem),   &cl_m_parent);
+		err |= clSetKernelArg(cl_k_lfill, 5, sizeof(uint32_t), &label_base);
+		
+		err |= clSetKernelArg(cl_k_llink, 0, sizeof(cl_mem),   &cl_m_binimg);
+		err |= clSetKernelArg(cl_k_llink, 1, sizeof(uint32_t), &img_rows);
+		err |= clSetKernelArg(cl_k_llink, 2, sizeof(uint32_t), &img_cols);
+		err |= clSetKernelArg(cl_k_llink, 3, sizeof(cl_mem),   &cl_m_labels);
+		err |= clSetKernelArg(cl_k_llink, 4, sizeof(cl_mem),   &cl_m_parent);
+		
+		err |= clSetKernelArg(cl_k_lresolve, 0, sizeof(uint32_t), &img_rows);
+		err |= clSetKernelArg(cl_k_lresolve, 1, sizeof(uint32_t), &img_cols);
+		err |= clSetKernelArg(cl_k_lresolve, 2, sizeof(cl_mem),   &cl_m_labels);
+		err |= clSetKernelArg(cl_k_lresolve, 3, sizeof(cl_mem),   &cl_m_parent);
+		assert(err == CL_SUCCESS); // failed to set arguments
+		
+		// the queue is in-order, so each pass sees the previous one's results
+		err  = clEnqueueNDRangeKernel(queue, cl_k_lfill, 1, NULL, &gsize, &lsize,
+		                              0, NULL, &lf_event);
+		err |= clEnqueueNDRangeKernel(queue, cl_k_llink, 1, NULL, &gsize, &lsize,
+		                              0, NULL, &ll_event);
+		err |= clEnqueueNDRangeKernel(queue, cl_k_lresolve, 1, NULL, &gsize, &lsize,
+		                              0, NULL, &lr_event);
+		assert(err == CL_SUCCESS); // failed to execute kernels
+		
+		clFinish(queue);
+		
+		OCL_DownloadBuffer(cl_m_labels, p_labels->data, label_bytes, &ldl_event);
+		
+		tp_labels = TimeProfile(NULL, &lf_event, &ldl_event);
+		tp_labels.k_time += TimeProfile(NULL, &ll_event, NULL).k_time;
+		tp_labels.k_time += TimeProfile(NULL, &lr_event, NULL).k_time;
+		
+		clReleaseEvent(lf_event);
+		clReleaseEvent(ll_event);
+		clReleaseEvent(lr_event);
+		clReleaseEvent(ldl_event);
+		
+		pool.Release(cl_m_labels);
+		pool.Release(cl_m_parent);
+	}
+	
 	clFinish(queue); // let the kernel finish execution
 	
+	// download the state which carries over to the next band, the
+	// contour table stays on the device (see StreamLengths())
+	if(stream)
+	{
+		OCL_DownloadBuffer(cl_m_cout, &carry[0], carry_bytes, &dl_event);
+	}
+	
 	// download the contour table
-	OCL_DownloadBuffer(cl_m_ctbl,
-	                   ctbl.data,
-	                   sizeof(uint32_t)*ctbl.rows*ctbl.cols,
-	                   &dl_event);
+	else
+	{
+		OCL_DownloadBuffer(cl_m_ctbl,
+		                   p_ctbl->data,
+		                   ctbl_bytes,
+		                   &dl_event);
+		
+		pool.Release(cl_m_ctbl);
+	}
+	
+	// download the number of contours started at each level
+	OCL_DownloadBuffer(cl_m_counts, p_cnt, cnt_bytes, NULL);
+	
+	pool.Release(cl_m_binimg);
+	pool.Release(cl_m_tokens);
+	
+	if(cl_m_cin)
+		pool.Release(cl_m_cin);
+	
+	if(cl_m_cout)
+		pool.Release(cl_m_cout);
+	
+	if(cl_m_thresh)
+	{
+		pool.Release(cl_m_thresh);
+		pool.Release(cl_m_counts);
+	}
+	
+	if(cl_m_stats)
+	{
+		OCL_DownloadBuffer(cl_m_stats, stats, sizeof(stats), NULL);
+		pool.Release(cl_m_stats);
+	}
 	
 	tp = TimeProfile(&ul_event, &k_event, &dl_event);
+	tp = tp + tp_labels;
+	
+	for(int i = 0; i < TC_COUNT; i++)
+		tp.counters[i] = stats[i];
+	
+	if(!stream)
+	{
+		tp.ul_time += TimeProfile(&ctbl_event, NULL, NULL).ul_time;
+		clReleaseEvent(ctbl_event);
+	}
+	
+	clReleaseEvent(ul_event);
+	clReleaseEvent(k_event);
+	clReleaseEvent(dl_event);
 }
@@ -30,8 +30,11 @@
 
 #include <opencv2/opencv.hpp>
 #include <string>
+#include <vector>
 
 #include "ocl_base.h"
+#include "ocl_bufpool.h"
+#include "ocl_tune.h"
 
 using namespace std;
 using namespace cv;
@@ -39,6 +42,34 @@ using namespace cv;
 #ifndef OCL_TTRACE_H_
 #define OCL_TTRACE_H_
 
+/*
+ * Hot-path counters, collected when OCL_TTrace is constructed with counters
+ * enabled. This list is their only definition: the kernel receives each
+ * index as a build option (e.g. "-D TC_ACTIVE=0", see BuildOptions()).
+ */
+
+#define TTRACE_COUNTER_LIST(X) \
+	X(TC_ACTIVE,  "pe_active")   /* PE cycles spent processing a pixel */ \
+	X(TC_STALLED, "pe_stalled")  /* PE cycles spent in the skew stall */ \
+	X(TC_IDLE,    "pe_idle")     /* PE cycles spent waiting (row finished or padding) */ \
+	X(TC_CASE1,   "case1")       /* cycles handling case 1 */ \
+	X(TC_CASE2,   "case2")       /* cycles handling case 2 */ \
+	X(TC_CASE3,   "case3")       /* cycles handling case 3 */ \
+	X(TC_TPASS,   "token_pass")  /* tokens passed to the next PE */ \
+	X(TC_START,   "start_point") /* starting points (outer and inner) */ \
+	X(TC_END,     "end_point")   /* end points */ \
+	X(TC_IDS,     "id_atomics")  /* atomic increments of the contour table counter */ \
+	X(TC_APPEND,  "ctbl_append") /* calls to ctbl_append() */ \
+	X(TC_DROP,    "ctbl_drop")   /* points dropped (table row full, or contour not in the table) */
+
+enum TTRACE_COUNTER
+{
+#define TC_ENUM(id, name) id,
+	TTRACE_COUNTER_LIST(TC_ENUM)
+#undef TC_ENUM
+	TC_COUNT
+};
+
 class TimeProfile
 {
 public:
@@ -49,9 +80,13 @@ public:
 	TimeProfile(TimeProfile *tp);
 	TimeProfile operator+(TimeProfile &tp);
 	
+	static const char *CounterName(int i);
+	
 	double ul_time; // units in seconds
 	double k_time;  // units in seconds
 	double dl_time; // units in seconds
+	
+	uint64_t counters[TC_COUNT]; // hot-path counters (zero unless enabled)
 };
 
 /**
@@ -62,17 +97,62 @@ class OCL_TTrace : public OCL_Base
 {
 public:
 	OCL_TTrace(string path, uint32_t img_width, uint32_t img_height, 
-	                        uint32_t ctbl_width, uint32_t ctbl_height);
+	                        uint32_t ctbl_width, uint32_t ctbl_height,
+	                        string options = "", bool counters = false);
 	~OCL_TTrace();
 	
 	void Trace(const Mat &img_in, Mat &ctbl, TimeProfile &tp);
+	void Trace(const Mat &img_in, Mat &ctbl, Mat &labels, TimeProfile &tp);
+	void Trace(const Mat &img_in, const vector<uint8_t> &thresholds,
+	           vector<Mat> &ctbls, vector<uint32_t> &counts, TimeProfile &tp);
+	void TracePyramid(const Mat &img_in, uint32_t factor, Mat &ctbl, TimeProfile &tp);
+	
+	void StreamBegin(uint32_t img_cols, uint32_t ctbl_rows, uint32_t ctbl_cols);
+	void StreamBand(const Mat &band, uint32_t row_base, TimeProfile &tp);
+	void StreamLengths(vector<uint32_t> &lengths, TimeProfile &tp);
+	void StreamRow(uint32_t row, uint32_t n, Mat &dst, TimeProfile &tp);
+	void StreamEnd();
+	uint32_t StreamCount() const { return stream_cnt; }
+	uint32_t StreamBandRows(uint32_t img_cols) const;
+	uint32_t TraceCount() const { return trace_cnt; }
+	
+	size_t DeviceMemUsage() const { return pool.CurrentUsage(); }
+	size_t DeviceMemPeak() const { return pool.PeakUsage(); }
+	void   SetDeviceMemLimit(size_t bytes) { pool.SetLimit(bytes); }
+	
+	static vector< vector<uint32_t> > SortedContours(const Mat &ctbl);
+	
+	string DeviceKey() const;
+	size_t MaxLocalSize() const { return max_lsize; }
 	
 private:
-	cl_mem    cl_m_binimg;  // buffer for binary image (U8)
-	cl_mem    cl_m_tokens;  // buffer for passing token data (U8)
+	static string BuildOptions(const string &options, bool counters);
+	static size_t GlobalSize(uint32_t img_rows, size_t lsize);
+	
+	void Launch(const Mat &img_in, uint32_t row_base, Mat *p_ctbl,
+	            uint32_t *p_cnt, bool stream, Mat *p_labels,
+	            const vector<uint8_t> *p_thresholds, TimeProfile &tp);
+	
+	OCL_BufferPool pool;    // device buffers, grown on demand
 	cl_mem    cl_m_cnt;     // buffer for the contour table counter (uint32)
-	cl_mem    cl_m_ctbl;    // buffer for the contour table (uint32[][])
 	cl_kernel cl_k_ttrace;  // handle for the token-trace kernel
+	cl_kernel cl_k_lfill;   // handle for the label fill kernel
+	cl_kernel cl_k_llink;   // handle for the label link kernel
+	cl_kernel cl_k_lresolve; // handle for the label resolve kernel
+	
+	bool      counters_on;  // collect the hot-path counters (TTRACE_COUNTERS)
+	
+	OCL_TuneProfile profile; // tuned streaming band heights
+	string    device_key;   // this device's key in the profile
+	size_t    max_lsize;    // largest usable work-group size
+	size_t    trace_lsize;  // work-group size of whole-image traces
+	
+	vector<uint8_t> carry;  // tokens entering the next band (token_t[cols])
+	cl_mem    cl_m_sctbl;   // contour table kept on the device while streaming
+	uint32_t  stream_rows;  // rows of the streamed contour table
+	uint32_t  stream_cols;  // columns of the streamed contour table
+	uint32_t  stream_cnt;   // next contour identifier while streaming
+	uint32_t  trace_cnt;    // contour identifiers handed out by the last Trace()
 };
 	
 #endif
\ No newline at end of file
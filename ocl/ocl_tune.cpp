@@ -0,0 +1,235 @@
+/**************************************************************************//**
+* @file   ocl_tune.cpp
+* @brief  This source file implements the persisted autotuning profile.
+* @author Matthew Triche
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+****************************************************************************/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdint.h>
+
+#include "ocl_tune.h"
+
+using namespace std;
+
+/* ------------------------------------------------------------------------- *
+ * Declare Internal Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+static bool entry_less(const tune_entry_t &a, const tune_entry_t &b);
+static uint32_t class_distance(uint32_t a, uint32_t b);
+
+/* ------------------------------------------------------------------------- *
+ * Define Internal Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Order entries by device, then by cols class.
+ */
+
+static bool entry_less(const tune_entry_t &a, const tune_entry_t &b)
+{
+	if(a.device != b.device)
+		return a.device < b.device;
+
+	return a.cols_class < b.cols_class;
+}
+
+/**
+ * @brief Get the number of doublings between two size classes.
+ */
+
+static uint32_t class_distance(uint32_t a, uint32_t b)
+{
+	uint32_t n = 0;
+
+	if(a > b)
+		swap(a, b);
+
+	while(a < b)
+	{
+		a <<= 1;
+		n++;
+	}
+
+	return n;
+}
+
+/* ------------------------------------------------------------------------- *
+ * Define Methods                                                            *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Read a profile, replacing any loaded entries.
+ *
+ * Malformed lines are skipped.
+ *
+ * @param path Path to the profile.
+ *
+ * @return False if the file couldn't be opened.
+ */
+
+bool OCL_TuneProfile::Load(const string &path)
+{
+	ifstream fin(path.c_str());
+	string line;
+
+	entries.clear();
+
+	if(!fin)
+		return false;
+
+	while(getline(fin, line))
+	{
+		istringstream in(line);
+		tune_entry_t entry;
+		double k_time_us;
+
+		if(line.empty() || (line[0] == '#'))
+			continue;
+
+		if(!(in >> entry.cols_class >> entry.band_rows >> k_time_us))
+			continue;
+
+		in >> ws;
+		getline(in, entry.device);
+
+		if(entry.device.empty() || (entry.band_rows == 0))
+			continue;
+
+		entry.k_time = k_time_us / 1e6;
+		Set(entry);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Write the profile.
+ *
+ * @param path Path to the profile.
+ *
+ * @return True if the whole file was written. False otherwise.
+ */
+
+bool OCL_TuneProfile::Save(const string &path) const
+{
+	ofstream fout(path.c_str());
+
+	if(!fout)
+		return false;
+
+	fout << "# token_trace autotuning profile (written by token_trace --tune)" << endl;
+	fout << "# <cols_class> <band_rows> <kernel_time_us> <device>" << endl;
+
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		fout << entries[i].cols_class << " "
+		     << entries[i].band_rows << " "
+		     << entries[i].k_time * 1e6 << " "
+		     << entries[i].device << endl;
+	}
+
+	return fout.good();
+}
+
+/**
+ * @brief Add an entry, replacing any entry for the same device and class.
+ *
+ * @param entry The entry to store.
+ */
+
+void OCL_TuneProfile::Set(const tune_entry_t &entry)
+{
+	vector<tune_entry_t>::iterator it;
+
+	it = lower_bound(entries.begin(), entries.end(), entry, entry_less);
+
+	if( (it != entries.end()) && (it->device == entry.device) &&
+	    (it->cols_class == entry.cols_class) )
+	{
+		*it = entry;
+	}
+
+	else
+	{
+		entries.insert(it, entry);
+	}
+}
+
+/**
+ * @brief Get the tuned streaming band height for an image.
+ *
+ * The entry of the image's width class is used if there is one. Otherwise
+ * the nearest tuned class of the same device is used.
+ *
+ * @param device   Device key.
+ * @param img_cols Image columns.
+ *
+ * @return The band height, or 0 if the device hasn't been tuned.
+ */
+
+uint32_t OCL_TuneProfile::Lookup(const string &device, uint32_t img_cols) const
+{
+	uint32_t cols_class = SizeClass(img_cols);
+	uint32_t best_rows = 0, best_dist = UINT32_MAX;
+
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		uint32_t dist;
+
+		if(entries[i].device != device)
+			continue;
+
+		// ties go to the larger class, which is visited later
+		dist = class_distance(entries[i].cols_class, cols_class);
+		if(dist <= best_dist)
+		{
+			best_dist = dist;
+			best_rows = entries[i].band_rows;
+		}
+	}
+
+	return best_rows;
+}
+
+/**
+ * @brief Get the size class of an image dimension.
+ *
+ * The columns give the number of cycles each PE runs.
+ *
+ * @param n Image columns.
+ *
+ * @return The size rounded up to a power of two.
+ */
+
+uint32_t OCL_TuneProfile::SizeClass(uint32_t n)
+{
+	uint32_t size_class = 1;
+
+	while((size_class < n) && (size_class < 0x80000000))
+		size_class <<= 1;
+
+	return size_class;
+}
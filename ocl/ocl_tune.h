@@ -0,0 +1,80 @@
+/**************************************************************************//**
+ * @file   ocl_tune.h
+ * @brief  Header file for the persisted autotuning profile.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+#ifndef OCL_TUNE_H_
+#define OCL_TUNE_H_
+
+/* ------------------------------------------------------------------------- *
+ * Define Constants                                                          *
+ * ------------------------------------------------------------------------- */
+
+#define TUNE_PROFILE_PATH "token_trace.tune" // default profile location
+
+/* ------------------------------------------------------------------------- *
+ * Define External Types                                                     *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief The fastest streaming band height found for one device and image
+ *        width class.
+ */
+
+typedef struct TUNE_ENTRY
+{
+	string   device;     // device key (see OCL_TTrace::DeviceKey())
+	uint32_t cols_class; // image columns, rounded up to a power of two
+	uint32_t band_rows;  // image rows traced per launch
+	double   k_time;     // kernel time measured by the tuner (seconds)
+} tune_entry_t;
+
+/**
+ * @brief A set of tuned band heights stored as a text file.
+ *
+ * Each line holds one entry: "<cols_class> <band_rows> <k_time_us> <device>".
+ * The device key comes last since it may contain spaces. Lines starting
+ * with '#' are comments.
+ */
+
+class OCL_TuneProfile
+{
+public:
+	bool Load(const string &path);
+	bool Save(const string &path) const;
+
+	void     Set(const tune_entry_t &entry);
+	uint32_t Lookup(const string &device, uint32_t img_cols) const;
+
+	static uint32_t SizeClass(uint32_t n);
+
+private:
+	vector<tune_entry_t> entries; // sorted by device, then cols class
+};
+
+#endif
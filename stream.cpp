@@ -0,0 +1,414 @@
+/**************************************************************************//**
+ * @file   stream.cpp
+ * @brief  This source file implements the out-of-core streaming mode.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <set>
+#include <string>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <stdio.h>
+
+#include "stream.h"
+#include "ctfile.h"
+#include "ocl/ocl_ttrace.h"
+
+using namespace std;
+using namespace cv;
+
+/* ------------------------------------------------------------------------- *
+ * Declare Internal Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+static bool read_header_value(const uint8_t *p_data, size_t size, size_t &pos, uint32_t &value);
+
+/* ------------------------------------------------------------------------- *
+ * Define Internal Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Read the next decimal value of a PBM/PGM header.
+ *
+ * Whitespace and '#' comments before the value are skipped.
+ *
+ * @param[in]     p_data File contents.
+ * @param[in]     size   File size in bytes.
+ * @param[in,out] pos    Current position in the file.
+ * @param[out]    value  The value read.
+ *
+ * @return True if a value was read. False otherwise.
+ */
+
+static bool read_header_value(const uint8_t *p_data, size_t size, size_t &pos, uint32_t &value)
+{
+	bool found = false;
+
+	while(pos < size)
+	{
+		if(p_data[pos] == '#')
+		{
+			while((pos < size) && (p_data[pos] != '\n'))
+				pos++;
+		}
+
+		else if(isspace(p_data[pos]))
+		{
+			pos++;
+		}
+
+		else
+		{
+			break;
+		}
+	}
+
+	value = 0;
+	while((pos < size) && isdigit(p_data[pos]))
+	{
+		value = 10*value + (p_data[pos++] - '0');
+		found = true;
+	}
+
+	return found;
+}
+
+/* ------------------------------------------------------------------------- *
+ * Define Methods                                                            *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief consturctor
+ */
+
+BandSource::BandSource()
+{
+	p_map    = NULL;
+	size     = 0;
+	p_pixels = NULL;
+	stride   = 0;
+	rows     = 0;
+	cols     = 0;
+	maxval   = 0;
+}
+
+/**
+ * @brief destructor
+ */
+
+BandSource::~BandSource()
+{
+	Close();
+}
+
+/**
+ * @brief Map a binary PBM (P4) or 8-bit PGM (P5) file.
+ *
+ * @param path Path to the image.
+ *
+ * @return True if the file was mapped and its header is supported.
+ */
+
+bool BandSource::Open(const string &path)
+{
+	struct stat st;
+	size_t pos = 2;
+	void *p;
+	int fd;
+
+	Close();
+
+	fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	if((fstat(fd, &st) != 0) || (st.st_size < 3))
+	{
+		close(fd);
+		return false;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+		return false;
+
+	p_map = (const uint8_t*)p;
+	size  = st.st_size;
+
+	// the image is read once from top to bottom
+	madvise(p, size, MADV_SEQUENTIAL);
+
+	if( (p_map[0] != 'P') || ((p_map[1] != '4') && (p_map[1] != '5')) ||
+	    !read_header_value(p_map, size, pos, cols) ||
+	    !read_header_value(p_map, size, pos, rows) ||
+	    ((p_map[1] == '5') && !read_header_value(p_map, size, pos, maxval)) )
+	{
+		Close();
+		return false;
+	}
+
+	// a single whitespace character separates the header from the pixels
+	pos++;
+
+	stride   = (p_map[1] == '4') ? ((cols + 7) / 8) : cols;
+	p_pixels = p_map + pos;
+
+	if( (maxval > 255) || (rows == 0) || (cols == 0) ||
+	    (pos > size) || ((size - pos) / stride < rows) )
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Unmap the image.
+ */
+
+void BandSource::Close()
+{
+	if(p_map)
+		munmap((void*)p_map, size);
+
+	p_map    = NULL;
+	size     = 0;
+	p_pixels = NULL;
+}
+
+/**
+ * @brief Binarize image rows into a buffer.
+ *
+ * @param[in]  row First image row.
+ * @param[in]  n   Number of rows.
+ * @param[out] dst Destination with room for n*Cols() bytes.
+ */
+
+void BandSource::ReadRows(uint32_t row, uint32_t n, uint8_t *dst) const
+{
+	for(uint32_t r = row; r < row + n; r++)
+	{
+		const uint8_t *p_src = p_pixels + stride*r;
+
+		if(maxval == 0)
+		{
+			// PBM: one bit per pixel, MSB first, '1' is black
+			for(uint32_t c = 0; c < cols; c++)
+			{
+				*dst++ = (p_src[c >> 3] >> (7 - (c & 7))) & 1;
+			}
+		}
+
+		else
+		{
+			for(uint32_t c = 0; c < cols; c++)
+			{
+				*dst++ = (p_src[c] != maxval) ? 1 : 0;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Let the OS drop mapped pages which are no longer needed.
+ *
+ * @param row Every row before this one has been traced.
+ */
+
+void BandSource::Discard(uint32_t row) const
+{
+	size_t page  = sysconf(_SC_PAGESIZE);
+	size_t bytes = (p_pixels - p_map) + stride*row;
+
+	bytes -= bytes % page;
+
+	if(bytes)
+		madvise((void*)p_map, bytes, MADV_DONTNEED);
+}
+
+/* ------------------------------------------------------------------------- *
+ * Define External Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Trace an image too large to hold in memory, one band at a time.
+ *
+ * Apart from the contour file index, host and device memory depend only on
+ * the band height, the image width and the contour table size. Contour
+ * identifiers wrap around the contour table, so every contour which
+ * terminates is spilled to the output file and its row is freed for reuse.
+ * If a row is claimed by a new contour before its previous contour was
+ * spilled, the previous contour is lost (counted in the file header) and
+ * the new one is flagged with CTF_OVERRUN, since its row may hold points of
+ * both.
+ *
+ * @param cfg Streaming settings.
+ *
+ * @return Process exit code.
+ */
+
+int RunStream(const stream_config_t &cfg_in)
+{
+	stream_config_t cfg = cfg_in;
+	BandSource src;
+	CTFileWriter writer;
+	TimeProfile tp, tp_sum;
+	deque<bool> spilled; // spilled (or lost) flags of the identifiers from 'oldest' on
+	set<uint32_t> collided; // identifiers whose row evicted an unspilled contour
+	uint32_t oldest = 0; // oldest contour identifier which isn't spilled yet
+	uint64_t n_overrun = 0, n_lost = 0;
+
+	if(!src.Open(cfg.in_path))
+	{
+		cerr << "Error: Unable to read '" << cfg.in_path << "' as a PBM/PGM image." << endl;
+		return 1;
+	}
+
+	if(!writer.Open(cfg.out_path, src.Rows(), src.Cols()))
+	{
+		cerr << "Error: Unable to create '" << cfg.out_path << "'." << endl;
+		return 1;
+	}
+
+	// the per-cycle kernel trace table would dominate the run time
+	OCL_TTrace contour("kernel.cl", src.Cols(), cfg.band_rows+1, cfg.ctbl_cols, cfg.ctbl_rows,
+	                   "-D TTRACE_QUIET");
+
+	/* NOTE: Tokens only pass safely between rows of the same work-group,
+	 * since barriers don't synchronize work-groups. Each band is traced by
+	 * a single work-group, which also needs one PE past the last row.
+	 */
+	if(cfg.band_rows == 0)
+	{
+		cfg.band_rows = contour.StreamBandRows(src.Cols());
+	}
+
+	else if(cfg.band_rows >= contour.MaxLocalSize())
+	{
+		cerr << "Error: The band height must be less than the work-group size ("
+		     << contour.MaxLocalSize() << ")." << endl;
+		return 1;
+	}
+
+	Mat row;
+	Mat band(cfg.band_rows+1, src.Cols(), CV_8U);
+	vector<uint32_t> lengths;
+
+	contour.StreamBegin(src.Cols(), cfg.ctbl_rows, cfg.ctbl_cols);
+
+	for(uint32_t r0 = 0; r0 < src.Rows(); r0 += cfg.band_rows)
+	{
+		uint32_t n    = min(cfg.band_rows, src.Rows() - r0);
+		uint32_t halo = (r0 != 0) ? 1 : 0;
+		Mat view      = band.rowRange(0, n + halo);
+
+		/* ------ Trace the Band ------ */
+
+		src.ReadRows(r0 - halo, n + halo, view.data);
+		contour.StreamBand(view, r0, tp);
+		tp_sum = tp_sum + tp;
+
+		// keep the last row, it's the next band's halo row
+		src.Discard(r0 + n - 1);
+
+		/* ------ Spill Terminated Contours ------ */
+
+		uint32_t cnt = contour.StreamCount();
+
+		spilled.resize(cnt - oldest, false);
+
+		// only the terminated rows are downloaded, the table stays on the device
+		contour.StreamLengths(lengths, tp_sum);
+
+		// a contour whose row was claimed by a newer one can't be recovered
+		for(uint32_t id = oldest; (cnt - id) > cfg.ctbl_rows; id++)
+		{
+			if(spilled[id - oldest])
+				continue;
+
+			spilled[id - oldest] = true;
+			n_lost++;
+
+			collided.erase(id);
+			collided.insert(id + cfg.ctbl_rows);
+		}
+
+		for(uint32_t id = oldest; id != cnt; id++)
+		{
+			uint32_t slot = id % cfg.ctbl_rows;
+			uint32_t flags;
+
+			// column 0 stays 0 until the row's newest contour terminates
+			if(spilled[id - oldest] || (lengths[slot] == 0))
+				continue;
+
+			flags = collided.erase(id) ? CTF_OVERRUN : 0;
+
+			contour.StreamRow(slot, min(lengths[slot], cfg.ctbl_cols), row, tp_sum);
+			writer.AppendRow(row, 0, id, flags);
+			n_overrun += flags ? 1 : 0;
+
+			// the kernel clears the row when the next identifier claims it
+			spilled[id - oldest] = true;
+		}
+
+		while(!spilled.empty() && spilled.front())
+		{
+			spilled.pop_front();
+			oldest++;
+		}
+	}
+
+	contour.StreamEnd();
+
+	/* ------ Output Results ------ */
+
+	uint32_t n_written = writer.Count();
+
+	writer.SetLost(n_lost);
+
+	if(!writer.Close())
+	{
+		cerr << "Error: Unable to write '" << cfg.out_path << "'." << endl;
+		return 1;
+	}
+
+	cerr << "contours      = " << n_written << " (" << count(spilled.begin(), spilled.end(), false) << " left open, "
+	     << n_overrun << " overrun, " << n_lost << " lost)" << endl;
+	cerr << "upload time   = " << tp_sum.ul_time * 1e6 << " us" << endl;
+	cerr << "kernel time   = " << tp_sum.k_time * 1e6 << " us" << endl;
+	cerr << "download time = " << tp_sum.dl_time * 1e6 << " us" << endl;
+	cerr << "device memory = " << contour.DeviceMemUsage() << " bytes (peak "
+	     << contour.DeviceMemPeak() << " bytes)" << endl;
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+/**************************************************************************//**
+ * @file   stream.h
+ * @brief  Header file for the out-of-core streaming mode.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+/* ------------------------------------------------------------------------- *
+ * Define External Types                                                     *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Streaming mode settings.
+ */
+
+typedef struct STREAM_CONFIG
+{
+	string   in_path;   // PBM (P4) or PGM (P5) image
+	string   out_path;  // contour file
+	uint32_t band_rows; // image rows traced per kernel launch (0 for the tuned height)
+	uint32_t ctbl_rows; // contour table rows (live contours at once)
+	uint32_t ctbl_cols; // contour table columns (points per contour)
+} stream_config_t;
+
+/**
+ * @brief Reads horizontal bands of a binary PBM/PGM file through mmap.
+ *
+ * Pixels are binarized the same way as the demo: black (PBM '1') or any
+ * gray level below the maximum is foreground.
+ */
+
+class BandSource
+{
+public:
+	BandSource();
+	~BandSource();
+
+	bool Open(const string &path);
+	void Close();
+
+	uint32_t Rows() const { return rows; }
+	uint32_t Cols() const { return cols; }
+
+	void ReadRows(uint32_t row, uint32_t n, uint8_t *dst) const;
+	void Discard(uint32_t row) const;
+
+private:
+	const uint8_t *p_map;    // start of the mapping
+	size_t         size;     // size of the mapping in bytes
+	const uint8_t *p_pixels; // first byte of pixel data
+	size_t         stride;   // bytes per image row
+	uint32_t       rows;     // image height
+	uint32_t       cols;     // image width
+	uint32_t       maxval;   // PGM maximum gray value (0 for PBM)
+};
+
+/* ------------------------------------------------------------------------- *
+ * Declare External Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+int RunStream(const stream_config_t &cfg);
+
+#endif
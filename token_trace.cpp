@@ -25,23 +25,39 @@
 #include <iostream>
 #include <vector>
 #include <queue>
+#include <thread>
+#include <algorithm>
 #include <string>
+#include <map>
 #include <opencv2/opencv.hpp>
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "ocl/ocl_ttrace.h"
+#include "batch.h"
+#include "ctfile.h"
+#include "stream.h"
+#include "tune.h"
 
 using namespace std;
 using namespace cv;
 
+int BatchMain(int argc, char **argv);
+int StreamMain(int argc, char **argv);
+int TuneMain(int argc, char **argv);
+int DumpContourFile(const char *path);
+uint64_t CompareLabels(OCL_TTrace &contour, const Mat &bin_img, size_t &n_found, int &n_expected);
+Mat FixtureImage(const char * const *rows, int n_rows);
+int LabelCheck(const char *path);
+int PyramidCheck(const char *path);
+int LevelCheck(const char *path);
 void DrawContourTable(Mat &img, Mat &ctbl);
 
 int main(int argc, char **argv)
 {
-	cout << "===== Token Trace =====" << endl;
-	
 	/* ------ Handle Arguments ------ */
 	
 	if(argc == 1)
@@ -50,17 +66,89 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 	
-	else if(argc > 2)
-	{
-		cout << "Error: Too many command-line arguments given." << endl;
-		exit(1);
-	}
-	
 	if(!strcmp(argv[1], "--help"))
 	{
 		cout << "Usage: token_trace <IMAGE_PATH>" << endl;
+		cout << "       token_trace --batch <DIR|LIST_FILE|-> [--out <DIR>] [--threads <N>]" << endl;
+		cout << "                   [--queue <N>] [--ctbl <ROWS> <COLS>] [--text] [--counters]" << endl;
+		cout << "                   [--pyramid <FACTOR>] [--mem-limit <MIB>]" << endl;
+		cout << "       token_trace --stream <PBM|PGM> <CONTOUR_FILE> [--band <ROWS>]" << endl;
+		cout << "                   [--ctbl <ROWS> <COLS>]" << endl;
+		cout << "       token_trace --dump <CONTOUR_FILE>" << endl;
+		cout << "       token_trace --labels [IMAGE_PATH]" << endl;
+		cout << "       token_trace --check-pyramid [IMAGE_PATH]" << endl;
+		cout << "       token_trace --check-levels [IMAGE_PATH]" << endl;
+		cout << "       token_trace --tune [--rows <N>] [--max-cols <N>] [--reps <N>]" << endl;
 		exit(0);
 	}
+	
+	if(!strcmp(argv[1], "--stream"))
+	{
+		return StreamMain(argc, argv);
+	}
+	
+	if(!strcmp(argv[1], "--tune"))
+	{
+		return TuneMain(argc, argv);
+	}
+	
+	if(!strcmp(argv[1], "--labels"))
+	{
+		if(argc > 3)
+		{
+			cout << "Error: Expected at most one image." << endl;
+			exit(1);
+		}
+		
+		return LabelCheck((argc == 3) ? argv[2] : NULL);
+	}
+	
+	if(!strcmp(argv[1], "--check-pyramid"))
+	{
+		if(argc > 3)
+		{
+			cout << "Error: Expected at most one image." << endl;
+			exit(1);
+		}
+		
+		return PyramidCheck((argc == 3) ? argv[2] : NULL);
+	}
+	
+	if(!strcmp(argv[1], "--check-levels"))
+	{
+		if(argc > 3)
+		{
+			cout << "Error: Expected at most one image." << endl;
+			exit(1);
+		}
+		
+		return LevelCheck((argc == 3) ? argv[2] : NULL);
+	}
+	
+	if(!strcmp(argv[1], "--dump"))
+	{
+		if(argc != 3)
+		{
+			cout << "Error: Expected exactly one contour file." << endl;
+			exit(1);
+		}
+		
+		return DumpContourFile(argv[2]);
+	}
+	
+	if(!strcmp(argv[1], "--batch"))
+	{
+		return BatchMain(argc, argv);
+	}
+	
+	if(argc > 2)
+	{
+		cout << "Error: Too many command-line arguments given." << endl;
+		exit(1);
+	}
+	
+	// the other modes keep stdout for their results
+	cout << "===== Token Trace =====" << endl;
 
 	/* ------ Initialize Data and Objects ------ */
 	
@@ -87,6 +175,12 @@ int main(int argc, char **argv)
 	
 	contour.Trace(bin_img, ctbl, tp);
 	
+	if(contour.TraceCount() > (uint32_t)ctbl.rows)
+	{
+		cout << "Warning: " << (contour.TraceCount() - ctbl.rows)
+		     << " contours didn't fit in the contour table." << endl;
+	}
+	
 	/* ------ Output Results ------ */
 
 	cout << "-------------------------------------------------------------------" << endl;
@@ -99,6 +193,8 @@ int main(int argc, char **argv)
 	cout << "upload time   = " << tp.ul_time * 1e6 << " us" << endl;
 	cout << "kernel time   = " << tp.k_time * 1e6 << " us" << endl;
 	cout << "download time = " << tp.dl_time * 1e6 << " us" << endl;
+	cout << "device memory = " << contour.DeviceMemUsage() << " bytes (peak " 
+	     << contour.DeviceMemPeak() << " bytes)" << endl;
 
 	Mat output;
 	resize(dbg_img,output,Size(20*dbg_img.cols,20*dbg_img.rows),0,0,INTER_NEAREST);
@@ -112,6 +208,509 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+int BatchMain(int argc, char **argv)
+{
+	batch_config_t cfg;
+	
+	cfg.n_decoders  = thread::hardware_concurrency() ? thread::hardware_concurrency() : 4;
+	cfg.queue_depth = 16;
+	cfg.ctbl_rows   = 256;
+	cfg.ctbl_cols   = 256;
+	cfg.text_out    = false;
+	cfg.counters    = false;
+	cfg.pyramid     = 0;
+	cfg.mem_limit   = (size_t)256 << 20;
+	
+	if(argc < 3)
+	{
+		cout << "Error: Missing batch source command-line argument." << endl;
+		exit(1);
+	}
+	
+	cfg.source = argv[2];
+	
+	for(int i = 3; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--out") && (i+1 < argc))
+		{
+			cfg.out_dir = argv[++i];
+		}
+		
+		else if(!strcmp(argv[i], "--threads") && (i+1 < argc))
+		{
+			cfg.n_decoders = max(1, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--queue") && (i+1 < argc))
+		{
+			cfg.queue_depth = max(1, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--ctbl") && (i+2 < argc))
+		{
+			cfg.ctbl_rows = max(1, atoi(argv[++i]));
+			cfg.ctbl_cols = max(3, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--text"))
+		{
+			cfg.text_out = true;
+		}
+		
+		else if(!strcmp(argv[i], "--counters"))
+		{
+			cfg.counters = true;
+		}
+		
+		else if(!strcmp(argv[i], "--pyramid") && (i+1 < argc))
+		{
+			cfg.pyramid = max(0, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--mem-limit") && (i+1 < argc))
+		{
+			cfg.mem_limit = (size_t)max(0, atoi(argv[++i])) << 20;
+		}
+		
+		else
+		{
+			cout << "Error: Unknown or incomplete argument '" << argv[i] << "'." << endl;
+			exit(1);
+		}
+	}
+	
+	return RunBatch(cfg);
+}
+
+int StreamMain(int argc, char **argv)
+{
+	stream_config_t cfg;
+	
+	cfg.band_rows = 0; // tuned height, else as many as one work-group can trace
+	cfg.ctbl_rows = 4096;
+	cfg.ctbl_cols = 1024;
+	
+	if(argc < 4)
+	{
+		cout << "Error: Missing image or contour file command-line argument." << endl;
+		exit(1);
+	}
+	
+	cfg.in_path  = argv[2];
+	cfg.out_path = argv[3];
+	
+	for(int i = 4; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--band") && (i+1 < argc))
+		{
+			cfg.band_rows = max(1, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--ctbl") && (i+2 < argc))
+		{
+			cfg.ctbl_rows = max(1, atoi(argv[++i]));
+			cfg.ctbl_cols = max(3, atoi(argv[++i]));
+		}
+		
+		else
+		{
+			cout << "Error: Unknown or incomplete argument '" << argv[i] << "'." << endl;
+			exit(1);
+		}
+	}
+	
+	return RunStream(cfg);
+}
+
+int TuneMain(int argc, char **argv)
+{
+	tune_config_t cfg;
+	
+	cfg.rows     = 1024;
+	cfg.max_cols = 2048;
+	cfg.reps     = 5;
+	
+	for(int i = 2; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "--rows") && (i+1 < argc))
+		{
+			cfg.rows = max(64, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--max-cols") && (i+1 < argc))
+		{
+			cfg.max_cols = max(256, atoi(argv[++i]));
+		}
+		
+		else if(!strcmp(argv[i], "--reps") && (i+1 < argc))
+		{
+			cfg.reps = max(1, atoi(argv[++i]));
+		}
+		
+		else
+		{
+			cout << "Error: Unknown or incomplete argument '" << argv[i] << "'." << endl;
+			exit(1);
+		}
+	}
+	
+	return RunTune(cfg);
+}
+
+int DumpContourFile(const char *path)
+{
+	CTFileReader reader;
+	
+	if(!reader.Open(path))
+	{
+		cout << "Error: Unable to read contour file '" << path << "'." << endl;
+		exit(1);
+	}
+	
+	cout << "image = " << reader.Header().img_cols << "x" << reader.Header().img_rows
+	     << ", contours = " << reader.Count()
+	     << ", points = " << reader.Header().n_points
+	     << ", lost = " << reader.Header().n_lost << endl;
+	
+	for(uint32_t i = 0; i < reader.Count(); i++)
+	{
+		const ctf_index_t &entry = reader.Index(i);
+		const ctf_point_t *p_pts = reader.Points(i);
+		
+		cout << entry.id << ((entry.flags & CTF_TRUNCATED) ? "*" : "")
+		     << ((entry.flags & CTF_OVERRUN) ? "!" : "") << " : ";
+		
+		for(uint32_t k = 0; k < entry.n_points; k++)
+		{
+			cout << "(" << p_pts[k].row << "," << p_pts[k].col << ") ";
+		}
+		
+		cout << endl;
+	}
+	
+	return 0;
+}
+
+uint64_t CompareLabels(OCL_TTrace &contour, const Mat &bin_img, size_t &n_found, int &n_expected)
+{
+	TimeProfile tp;
+	Mat labels, expected;
+	map<int, int> fwd, rev; // label correspondences in both directions
+	uint64_t n_mismatch = 0;
+	
+	Mat ctbl = Mat::zeros(4096, 256, CV_32S);
+	
+	contour.Trace(bin_img, ctbl, labels, tp);
+	n_expected = connectedComponents(bin_img, expected, 8, CV_32S) - 1;
+	
+	// labels match if both images partition the pixels the same way
+	for(int row = 0; row < bin_img.rows; row++)
+	{
+		for(int col = 0; col < bin_img.cols; col++)
+		{
+			int a = labels.at<int>(row, col);
+			int b = expected.at<int>(row, col);
+			
+			if((fwd.count(a) && (fwd[a] != b)) || (rev.count(b) && (rev[b] != a)))
+			{
+				n_mismatch++;
+				continue;
+			}
+			
+			fwd[a] = b;
+			rev[b] = a;
+		}
+	}
+	
+	n_found = fwd.size() - (fwd.count(0) ? 1 : 0);
+	
+	return n_mismatch;
+}
+
+Mat FixtureImage(const char * const *rows, int n_rows)
+{
+	Mat img = Mat::zeros(n_rows, strlen(rows[0]), CV_8U);
+	
+	for(int row = 0; row < img.rows; row++)
+	{
+		for(int col = 0; col < img.cols; col++)
+		{
+			img.at<uint8_t>(row, col) = (rows[row][col] == '#') ? 255 : 0;
+		}
+	}
+	
+	return img;
+}
+
+int LabelCheck(const char *path)
+{
+	// shapes whose components are only joined diagonally or at the bottom
+	static const char * const comb[]    = { ".#.#.#.", ".#####." };
+	static const char * const fork[]    = { "#...#", "#...#", ".#.#.", "..#.." };
+	static const char * const diag[]    = { "#....#", ".#..#.", "..##..", "..##..", ".#..#.", "#....#" };
+	static const char * const checker[] = { "#.#.#.", ".#.#.#", "#.#.#.", ".#.#.#" };
+	static const char * const nested[]  = { "#######", "#.....#", "#.###.#", "#.#.#.#",
+	                                        "#.###.#", "#.....#", "#######" };
+	static const char * const stairs[]  = { "##....", ".##...", "..##..", "...##.", "....##" };
+	
+	vector<Mat> images;
+	vector<string> names;
+	uint64_t n_failed = 0;
+	unsigned int seed = 1;
+	
+	if(path)
+	{
+		Mat bin_img = imread(path, IMREAD_GRAYSCALE);
+		
+		if(!bin_img.data)
+		{
+			cout << "Error: Unable to read '" << path << "'." << endl;
+			exit(1);
+		}
+		
+		bitwise_not(bin_img, bin_img);
+		images.push_back(bin_img);
+		names.push_back(path);
+	}
+	
+	else
+	{
+		images.push_back(FixtureImage(comb, 2));    names.push_back("comb");
+		images.push_back(FixtureImage(fork, 4));    names.push_back("fork");
+		images.push_back(FixtureImage(diag, 6));    names.push_back("diagonals");
+		images.push_back(FixtureImage(checker, 4)); names.push_back("checkerboard");
+		images.push_back(FixtureImage(nested, 7));  names.push_back("nested rings");
+		images.push_back(FixtureImage(stairs, 5));  names.push_back("stairs");
+		
+		// reproducible random images of various densities
+		for(int i = 0; i < 64; i++)
+		{
+			Mat img(8 + rand_r(&seed) % 57, 8 + rand_r(&seed) % 57, CV_8U);
+			int density = 10 + rand_r(&seed) % 81;
+			
+			for(int k = 0; k < img.rows*img.cols; k++)
+			{
+				img.data[k] = ((int)(rand_r(&seed) % 100) < density) ? 255 : 0;
+			}
+			
+			images.push_back(img);
+			names.push_back("random " + to_string(i));
+		}
+	}
+	
+	OCL_TTrace contour("kernel.cl", 64, 64, 256, 4096, "-D TTRACE_QUIET");
+	
+	for(size_t i = 0; i < images.size(); i++)
+	{
+		size_t n_found;
+		int n_expected;
+		uint64_t n_mismatch = CompareLabels(contour, images[i], n_found, n_expected);
+		
+		cout << names[i] << ": components = " << n_found << " (expected " << n_expected
+		     << "), mismatches = " << n_mismatch << " pixels" << endl;
+		
+		n_failed += (n_mismatch != 0) ? 1 : 0;
+	}
+	
+	cout << (images.size() - n_failed) << " of " << images.size() << " images labelled correctly" << endl;
+	
+	return (n_failed == 0) ? 0 : 1;
+}
+
+int PyramidCheck(const char *path)
+{
+	static const char * const blob[]   = { "........", "........", "..##....", "..##....",
+	                                       "........", "........", "........", "........" };
+	static const char * const bottom[] = { "........", "........", "........", "........",
+	                                       "........", "........", ".....##.", ".....##." };
+	static const char * const ring[]   = { "................", "................",
+	                                       "..#####.........", "..#...#.........",
+	                                       "..#.#.#.........", "..#...#.........",
+	                                       "..#####.........", "................",
+	                                       "................", "................",
+	                                       "..........###...", "..........#.#...",
+	                                       "..........###...", "................",
+	                                       "................", "................" };
+	static const uint32_t factors[] = { 2, 3, 4 };
+	
+	vector<Mat> images;
+	vector<string> names;
+	uint64_t n_checks = 0, n_failed = 0;
+	unsigned int seed = 1;
+	
+	if(path)
+	{
+		Mat bin_img = imread(path, IMREAD_GRAYSCALE);
+		
+		if(!bin_img.data)
+		{
+			cout << "Error: Unable to read '" << path << "'." << endl;
+			exit(1);
+		}
+		
+		bitwise_not(bin_img, bin_img);
+		images.push_back(bin_img);
+		names.push_back(path);
+	}
+	
+	else
+	{
+		images.push_back(FixtureImage(blob, 8));   names.push_back("blob");
+		images.push_back(FixtureImage(bottom, 8)); names.push_back("bottom");
+		images.push_back(FixtureImage(ring, 16));  names.push_back("rings");
+		
+		// reproducible sparse images, a few rectangles each
+		for(int i = 0; i < 16; i++)
+		{
+			Mat img = Mat::zeros(32 + rand_r(&seed) % 97, 32 + rand_r(&seed) % 97, CV_8U);
+			int n_blobs = 1 + rand_r(&seed) % 6;
+			
+			for(int k = 0; k < n_blobs; k++)
+			{
+				int h = 1 + rand_r(&seed) % 8;
+				int w = 1 + rand_r(&seed) % 8;
+				
+				img(Rect(rand_r(&seed) % (img.cols - w), rand_r(&seed) % (img.rows - h), w, h)).setTo(Scalar(255));
+			}
+			
+			images.push_back(img);
+			names.push_back("random " + to_string(i));
+		}
+	}
+	
+	OCL_TTrace contour("kernel.cl", 128, 128, 256, 1024, "-D TTRACE_QUIET");
+	
+	Mat ctbl(1024, 256, CV_32S);
+	
+	for(size_t i = 0; i < images.size(); i++)
+	{
+		TimeProfile tp;
+		vector< vector<uint32_t> > expected;
+		
+		ctbl.setTo(Scalar(0));
+		contour.Trace(images[i], ctbl, tp);
+		expected = OCL_TTrace::SortedContours(ctbl);
+		
+		for(size_t k = 0; k < sizeof(factors)/sizeof(factors[0]); k++)
+		{
+			ctbl.setTo(Scalar(0));
+			contour.TracePyramid(images[i], factors[k], ctbl, tp);
+			
+			bool match = (OCL_TTrace::SortedContours(ctbl) == expected);
+			
+			cout << names[i] << ", factor " << factors[k] << ": contours = " << expected.size()
+			     << (match ? "" : " (differ)") << endl;
+			
+			n_checks++;
+			n_failed += match ? 0 : 1;
+		}
+	}
+	
+	cout << (n_checks - n_failed) << " of " << n_checks << " pyramid traces match the whole-image trace" << endl;
+	
+	return (n_failed == 0) ? 0 : 1;
+}
+
+int LevelCheck(const char *path)
+{
+	static const uint8_t levels[] = { 0, 48, 96, 144, 192, 240 };
+	
+	vector<uint8_t> thresholds(levels, levels + sizeof(levels)/sizeof(levels[0]));
+	vector<Mat> images;
+	vector<string> names;
+	uint64_t n_checks = 0, n_failed = 0;
+	unsigned int seed = 1;
+	
+	if(path)
+	{
+		Mat img = imread(path, IMREAD_GRAYSCALE);
+		
+		if(!img.data)
+		{
+			cout << "Error: Unable to read '" << path << "'." << endl;
+			exit(1);
+		}
+		
+		images.push_back(img);
+		names.push_back(path);
+	}
+	
+	else
+	{
+		Mat radial(64, 64, CV_8U);
+		
+		// concentric iso-contours
+		for(int row = 0; row < radial.rows; row++)
+		{
+			for(int col = 0; col < radial.cols; col++)
+			{
+				double d = sqrt((double)(row-32)*(row-32) + (double)(col-32)*(col-32));
+				radial.at<uint8_t>(row, col) = (uint8_t)max(0.0, 255.0 - 6.0*d);
+			}
+		}
+		
+		images.push_back(radial);
+		names.push_back("radial");
+		
+		// reproducible images of random gray blocks
+		for(int i = 0; i < 16; i++)
+		{
+			Mat img(16 + rand_r(&seed) % 81, 16 + rand_r(&seed) % 81, CV_8U);
+			int block = 1 + rand_r(&seed) % 6;
+			
+			for(int row = 0; row < img.rows; row += block)
+			{
+				for(int col = 0; col < img.cols; col += block)
+				{
+					Rect r = Rect(col, row, block, block) & Rect(0, 0, img.cols, img.rows);
+					img(r).setTo(Scalar(rand_r(&seed) % 256));
+				}
+			}
+			
+			images.push_back(img);
+			names.push_back("random " + to_string(i));
+		}
+	}
+	
+	OCL_TTrace contour("kernel.cl", 96, 96, 256, 1024, "-D TTRACE_QUIET");
+	
+	for(size_t i = 0; i < images.size(); i++)
+	{
+		TimeProfile tp;
+		vector<Mat> ctbls;
+		vector<uint32_t> counts;
+		
+		for(size_t k = 0; k < thresholds.size(); k++)
+		{
+			ctbls.push_back(Mat::zeros(1024, 256, CV_32S));
+		}
+		
+		contour.Trace(images[i], thresholds, ctbls, counts, tp);
+		
+		for(size_t k = 0; k < thresholds.size(); k++)
+		{
+			Mat bin_img, ctbl = Mat::zeros(1024, 256, CV_32S);
+			
+			threshold(images[i], bin_img, thresholds[k], 255, THRESH_BINARY);
+			contour.Trace(bin_img, ctbl, tp);
+			
+			bool match = (counts[k] == contour.TraceCount()) &&
+			             (OCL_TTrace::SortedContours(ctbls[k]) == OCL_TTrace::SortedContours(ctbl));
+			
+			cout << names[i] << ", threshold " << (int)thresholds[k] << ": contours = "
+			     << counts[k] << " (expected " << contour.TraceCount() << ")"
+			     << (match ? "" : " (differ)") << endl;
+			
+			n_checks++;
+			n_failed += match ? 0 : 1;
+		}
+	}
+	
+	cout << (n_checks - n_failed) << " of " << n_checks << " levels match a single-level trace" << endl;
+	
+	return (n_failed == 0) ? 0 : 1;
+}
+
 void DrawContourTable(Mat &img, Mat &ctbl)
 {
 	for(int row = 0; row < ctbl.rows; row++)
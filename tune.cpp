@@ -0,0 +1,269 @@
+/**************************************************************************//**
+ * @file   tune.cpp
+ * @brief  This source file implements the autotuning mode.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "tune.h"
+#include "ocl/ocl_ttrace.h"
+#include "ocl/ocl_tune.h"
+
+using namespace std;
+using namespace cv;
+
+/* ------------------------------------------------------------------------- *
+ * Define Constants                                                          *
+ * ------------------------------------------------------------------------- */
+
+#define TUNE_MIN_COLS   (256) // smallest width class (columns)
+#define TUNE_MIN_LOCAL  (8)   // smallest work-group size tried
+#define TUNE_CTBL_COLS  (256) // contour table columns
+
+/* ------------------------------------------------------------------------- *
+ * Declare Internal Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+static void make_workload(uint32_t rows, uint32_t cols, Mat &img, uint32_t &n_blobs);
+static vector< vector<uint32_t> > stream_contours(OCL_TTrace &contour, const Mat &img,
+                                                  uint32_t band_rows, Mat &ctbl, double &k_time);
+
+/* ------------------------------------------------------------------------- *
+ * Define Internal Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Draw a reproducible synthetic binary image.
+ *
+ * The image holds scattered rectangles of various sizes, so every PE sees a
+ * mix of background and contour work.
+ *
+ * @param[in]  rows    Image rows.
+ * @param[in]  cols    Image columns.
+ * @param[out] img     Binary image (U8).
+ * @param[out] n_blobs Number of rectangles drawn.
+ */
+
+static void make_workload(uint32_t rows, uint32_t cols, Mat &img, uint32_t &n_blobs)
+{
+	unsigned int seed = rows ^ (cols << 16);
+
+	img     = Mat::zeros(rows, cols, CV_8U);
+	n_blobs = (uint32_t)(((uint64_t)rows * cols) / 2048);
+
+	for(uint32_t i = 0; i < n_blobs; i++)
+	{
+		int h = 2 + rand_r(&seed) % 15;
+		int w = 2 + rand_r(&seed) % 15;
+		int r = rand_r(&seed) % max(1, (int)rows - h);
+		int c = rand_r(&seed) % ((int)cols - w);
+
+		img(Rect(c, r, w, h)).setTo(Scalar(255));
+	}
+}
+
+/**
+ * @brief Trace an image in bands which each fit in one work-group.
+ *
+ * The bands are traced like in streaming mode (see OCL_TTrace::StreamBand()),
+ * which only passes tokens within a work-group, so every band height is
+ * correct at any image size. The table must have a row for every contour,
+ * so that no identifier wraps around and it ends up laid out like the
+ * table of a whole-image trace.
+ *
+ * @param[in,out] contour   Tracer.
+ * @param[in]     img       Binary image (U8, continuous).
+ * @param[in]     band_rows Image rows per band (less than MaxLocalSize()).
+ * @param[out]    ctbl      Contour table (S32, continuous).
+ * @param[out]    k_time    Total kernel time of the bands (seconds).
+ *
+ * @return The contours' points, sorted (see OCL_TTrace::SortedContours()).
+ */
+
+static vector< vector<uint32_t> > stream_contours(OCL_TTrace &contour, const Mat &img,
+                                                  uint32_t band_rows, Mat &ctbl, double &k_time)
+{
+	uint32_t rows = img.rows;
+	vector<uint32_t> lengths;
+	TimeProfile tp;
+	Mat row;
+
+	k_time = 0.0;
+	ctbl.setTo(Scalar(0));
+	contour.StreamBegin(img.cols, ctbl.rows, ctbl.cols);
+
+	for(uint32_t r0 = 0; r0 < rows; r0 += band_rows)
+	{
+		uint32_t n    = min(band_rows, rows - r0);
+		uint32_t halo = (r0 != 0) ? 1 : 0;
+
+		contour.StreamBand(img.rowRange(r0 - halo, r0 + n), r0, tp);
+		k_time += tp.k_time;
+	}
+
+	assert(contour.StreamCount() <= (uint32_t)ctbl.rows); // identifiers wrapped around
+
+	contour.StreamLengths(lengths, tp);
+
+	for(int r = 0; r < ctbl.rows; r++)
+	{
+		if(lengths[r] == 0)
+			continue;
+
+		Mat dst = ctbl.row(r);
+
+		contour.StreamRow(r, min(lengths[r], (uint32_t)ctbl.cols), row, tp);
+		row.copyTo(dst);
+	}
+
+	contour.StreamEnd();
+
+	return OCL_TTrace::SortedContours(ctbl);
+}
+
+/* ------------------------------------------------------------------------- *
+ * Define External Functions                                                 *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Find the fastest streaming band height for each image width class.
+ *
+ * Each power-of-two width class up to 'max_cols' is tuned on a synthetic
+ * image of 'rows' rows. Every candidate band height (a work-group size
+ * minus one) streams the whole image 'reps' times after one warm-up pass,
+ * and its fastest total kernel time counts. The tallest band is the
+ * reference, and a candidate whose contours differ from it is an error.
+ * The winners are merged into the profile at TUNE_PROFILE_PATH, which
+ * OCL_TTrace reads when it's constructed (see OCL_TTrace::StreamBandRows()).
+ *
+ * @param cfg Autotuning settings.
+ *
+ * @return Process exit code.
+ */
+
+int RunTune(const tune_config_t &cfg)
+{
+	OCL_TuneProfile profile;
+	vector<uint32_t> candidates;
+	uint32_t n_failed = 0;
+
+	// pre-sized for the widest image and the tallest band
+	OCL_TTrace contour("kernel.cl", cfg.max_cols, 128, TUNE_CTBL_COLS, 1024,
+	                   "-D TTRACE_QUIET");
+
+	string device = contour.DeviceKey();
+
+	// keep the entries of other devices and classes
+	profile.Load(TUNE_PROFILE_PATH);
+
+	for(size_t lsize = TUNE_MIN_LOCAL; lsize < contour.MaxLocalSize(); lsize *= 2)
+	{
+		candidates.push_back(lsize - 1);
+	}
+
+	// the tallest band comes last and is the reference
+	candidates.push_back(contour.MaxLocalSize() - 1);
+
+	cerr << "device = " << device << endl;
+
+	for(uint32_t cols = TUNE_MIN_COLS; cols <= cfg.max_cols; cols *= 2)
+	{
+		Mat img, ctbl;
+		uint32_t n_blobs;
+		double k_time;
+		vector< vector<uint32_t> > reference;
+		tune_entry_t best;
+
+		make_workload(cfg.rows, cols, img, n_blobs);
+
+		best.device     = device;
+		best.cols_class = OCL_TuneProfile::SizeClass(cols);
+		best.band_rows  = 0;
+		best.k_time     = 0.0;
+
+		// every contour fits, so the table never wraps around
+		ctbl.create(4*n_blobs + 64, TUNE_CTBL_COLS, CV_32S);
+
+		reference = stream_contours(contour, img, candidates.back(), ctbl, k_time);
+
+		for(size_t i = 0; i < candidates.size(); i++)
+		{
+			bool match = true;
+
+			k_time = 0.0;
+
+			// the first pass is a warm-up, but its results are checked too
+			for(uint32_t rep = 0; rep <= cfg.reps; rep++)
+			{
+				double t;
+
+				match = match && (stream_contours(contour, img, candidates[i], ctbl, t) == reference);
+
+				if((rep == 1) || ((rep > 1) && (t < k_time)))
+				{
+					k_time = t;
+				}
+			}
+
+			cerr << "cols = " << cols << ", band rows = " << candidates[i] << ": ";
+
+			if(!match)
+			{
+				cerr << "contours differ from the reference" << endl;
+				n_failed++;
+				continue;
+			}
+
+			cerr << k_time * 1e6 << " us" << endl;
+
+			if((best.band_rows == 0) || (k_time < best.k_time))
+			{
+				best.band_rows = candidates[i];
+				best.k_time    = k_time;
+			}
+		}
+
+		// the reference always matches itself
+		profile.Set(best);
+	}
+
+	if(!profile.Save(TUNE_PROFILE_PATH))
+	{
+		cerr << "Error: Unable to write '" << TUNE_PROFILE_PATH << "'." << endl;
+		return 1;
+	}
+
+	cerr << "profile written to '" << TUNE_PROFILE_PATH << "'" << endl;
+
+	if(n_failed != 0)
+	{
+		cerr << "Error: " << n_failed << " band heights traced different contours." << endl;
+		return 1;
+	}
+
+	return 0;
+}
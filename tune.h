@@ -0,0 +1,51 @@
+/**************************************************************************//**
+ * @file   tune.h
+ * @brief  Header file for the autotuning mode.
+ * @author Matthew Triche
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *****************************************************************************/
+
+#include <stdint.h>
+
+#ifndef TUNE_H_
+#define TUNE_H_
+
+/* ------------------------------------------------------------------------- *
+ * Define External Types                                                     *
+ * ------------------------------------------------------------------------- */
+
+/**
+ * @brief Autotuning mode settings.
+ */
+
+typedef struct TUNE_CONFIG
+{
+	uint32_t rows;     // rows of the streamed images
+	uint32_t max_cols; // largest width class to tune (image columns)
+	uint32_t reps;     // timed launches per configuration
+} tune_config_t;
+
+/* ------------------------------------------------------------------------- *
+ * Declare External Functions                                                *
+ * ------------------------------------------------------------------------- */
+
+int RunTune(const tune_config_t &cfg);
+
+#endif